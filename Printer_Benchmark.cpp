@@ -0,0 +1,1494 @@
+/*------------------------------------------------------------------------
+  Host benchmark for the Thermal_Print library.
+
+  Standard print jobs (receipts, tickets, tables, styled and UTF-8
+  text, bitmaps, labels, barcodes and QR codes, each blocking and some
+  queued with setAsync()) run through Thermal_Print into the virtual
+  printer (Thermal_Emulator) on a simulated clock.  For each job:
+    bytes      bytes sent to the printer
+    mech_us    time until the printer has finished printing everything
+    wait_us    time the library spent waiting on its pacing timer
+    call_us    caller-visible latency per API call (mean, max), in
+               simulated printer time -- how long the call blocks
+    call_ns    host CPU time per API call (mean)
+    overruns   bytes the printer would have lost (must be 0)
+
+  The sections after that each measure or check one feature, in the
+  order they run:
+    batching   waits and time to first dot, batched versus not
+    dither     image dithering throughput, megapixels per second, and
+               each vector kernel's output against the scalar one's
+    transcode  writeUTF8() throughput, megabytes per second
+    qr         symbol generation time, fresh and cached, and its cost
+               on the link as a payload versus as a bitmap; printQR()
+               must send the same with a cache as without
+    station    two printers, one after the other versus interleaved
+               by Thermal_Scheduler
+    queued     output queued with setAsync() is byte for byte what
+               the same job sends blocking
+    wide       an 80 mm profile on both ends prints as it should
+               (skipped in a THERMAL_PROFILE build)
+    elision    bytes and printing time raster elision saves on a
+               corpus of images, which must print the same
+    pipeline   the receipt through a Thermal_Pipeline engine thread,
+               which must print the same as directly, and a stress
+               run checking random output arrives intact (build with
+               THERMAL_TSAN to have ThreadSanitizer check it)
+    spool      a lunch rush through a Thermal_Spool log file (enqueue
+               latency, jobs per second, bytes logged per byte
+               printed), and recovery from a reset mid-job
+    serial     Thermal_LinuxSerial on a pty sends exactly what the
+               job produced and refuses rates it can't set, and flow
+               control is refused where the transport has none
+    fleet      Thermal_Fleet pacing up to 64 pty-backed printers in
+               real time (CPU per printer, timer lateness, which must
+               stay under 50 ms), and one line longer than the TX
+               queue
+    estimate   Thermal_Estimator's dry-run cost of the receipt against
+               the emulator, its speed, and routing a stream of
+               tickets across three unlike printers by estimate
+               versus round robin
+
+  With the library built with THERMAL_STATS, each job also reports
+  the library's own counters (see Thermal_Print::getStats()).
+
+  Usage: Printer_Benchmark [--json]
+  --json prints one JSON object per line instead of a table, for
+  tracking regressions across releases.
+  ------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "Thermal_Print.h"
+#include "Thermal_Image.h"
+#include "Thermal_Emulator.h"
+#include "Thermal_Template.h"
+#include "Thermal_Scheduler.h"
+#include "Thermal_Pipeline.h"
+#include "Thermal_Linux.h"
+#include "Thermal_Fleet.h"
+#include "Thermal_Estimate.h"
+
+static bool json = false;
+
+// Simulated clock that also totals up how long the library slept.
+class BenchClock : public Thermal_SimClock {
+ public:
+  BenchClock() { slept = sleeps = late = 0; }
+  void sleepMicros(uint32_t us) {
+    slept += us + late;
+    sleeps++;
+    Thermal_SimClock::sleepMicros(us + late);
+  }
+  uint64_t      slept;
+  unsigned long sleeps;
+  uint32_t      late;     // Added to every sleep, as a real one wakes late
+};
+
+static uint64_t hostNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// One printer, its virtual paper and the measurements for one job.
+struct Bench {
+  Thermal_Emulator          emu;
+  BenchClock                clock;
+  Thermal_EmulatorTransport line;
+  Thermal_Print             printer;
+  unsigned long             calls;
+  uint64_t                  callSim, callSimMax, callHost,
+                            start, waitStart, bytesStart,
+                            simMark, hostMark;
+
+  Bench() : line(emu, clock), printer(&line, &clock) {
+    printer.begin();
+    printer.drain();
+    emu.idleTime();
+#ifdef THERMAL_STATS
+    printer.resetStats();
+#endif
+    calls      = 0;
+    callSim    = callSimMax = callHost = 0;
+    start      = clock.time();
+    waitStart  = clock.slept;
+    bytesStart = emu.bytesReceived;
+  }
+  void before() {
+    simMark  = clock.time();
+    hostMark = hostNanos();
+  }
+  void after() {
+    uint64_t host = hostNanos() - hostMark;
+    uint64_t sim  = clock.time() - simMark;
+    calls++;
+    callHost += host;
+    callSim  += sim;
+    if(sim > callSimMax) callSimMax = sim;
+  }
+  void report(const char *name) {
+    printer.drain();
+    uint64_t mech  = emu.idleTime() - start;
+    uint64_t wait  = clock.slept - waitStart;
+    unsigned long bytes = emu.bytesReceived - bytesStart;
+    double   mean  = calls ? (double)callSim  / calls : 0;
+    double   ns    = calls ? (double)callHost / calls : 0;
+    if(json) {
+      printf("{\"workload\":\"%s\",\"bytes\":%lu,\"mech_us\":%llu,"
+        "\"wait_us\":%llu,\"calls\":%lu,\"call_us_mean\":%.1f,"
+        "\"call_us_max\":%llu,\"call_ns_mean\":%.1f,\"overruns\":%lu}\n",
+        name, bytes, (unsigned long long)mech, (unsigned long long)wait,
+        calls, mean, (unsigned long long)callSimMax, ns, emu.overruns);
+    } else {
+      printf("%-10s %8lu %12llu %12llu %7lu %10.1f %10llu %9.1f %8lu\n",
+        name, bytes, (unsigned long long)mech, (unsigned long long)wait,
+        calls, mean, (unsigned long long)callSimMax, ns, emu.overruns);
+    }
+#ifdef THERMAL_STATS
+    stats(name);
+#endif
+  }
+#ifdef THERMAL_STATS
+  void stats(const char *name) {
+    Thermal_Stats s;
+    printer.getStats(&s);
+    if(json) {
+      printf("{\"workload\":\"%s\",\"stats\":{\"bytes\":%lu,"
+        "\"newlines\":%lu,\"wraps\":%lu,\"waits\":%lu,"
+        "\"wait_us\":%llu,\"wait_max\":%lu,\"delays\":[", name,
+        (unsigned long)s.bytes, (unsigned long)s.newlines,
+        (unsigned long)s.wraps, (unsigned long)s.waits,
+        (unsigned long long)s.waitTotal, (unsigned long)s.waitMax);
+      for(int i=0; i<THERMAL_STATS_BUCKETS; i++)
+        printf("%s%lu", i ? "," : "", (unsigned long)s.delays[i]);
+      printf("],\"opcodes\":{");
+      for(int i=0, n=0; (i<THERMAL_STATS_OPCODES) && s.opcodes[i].count; i++)
+        printf("%s\"%04x\":%lu", n++ ? "," : "", s.opcodes[i].opcode,
+          (unsigned long)s.opcodes[i].count);
+      printf("}}}\n");
+    } else {
+      printf("  stats: %lu newlines, %lu wraps, %lu waits (max %lu us),"
+        " commands:", (unsigned long)s.newlines, (unsigned long)s.wraps,
+        (unsigned long)s.waits, (unsigned long)s.waitMax);
+      for(int i=0; (i<THERMAL_STATS_OPCODES) && s.opcodes[i].count; i++)
+        printf(" %04x=%lu", s.opcodes[i].opcode,
+          (unsigned long)s.opcodes[i].count);
+      printf("\n");
+    }
+  }
+#endif
+};
+
+#define CALL(b, expr) do { (b).before(); expr; (b).after(); } while(0)
+
+static void text(Bench &b, const char *s) {
+  CALL(b, b.printer.write(s));
+}
+
+// ----------------------------------------------------------------------
+// Workloads
+
+// Plain receipt: 60 item lines, one style throughout.
+static void receipt(Bench &b) {
+  for(int i=0; i<60; i++) {
+    CALL(b, b.printer.printf("Item %02d ............... $%2d.%02d\n",
+      i, (i * 37) % 50, (i * 13) % 100));
+  }
+  CALL(b, b.printer.feed(3));
+}
+
+// The same receipt with output queued (setAsync()): calls return once
+// their line is queued, and only block while the TX queue is full.  No
+// background timer here, so the queue drains as calls make room.
+static void queued(Bench &b) {
+  b.printer.setAsync();
+  receipt(b);
+}
+
+// A kitchen ticket short enough to fit in the TX queue, printed
+// blocking and then queued: once queued, no call waits at all.
+static void ticket(Bench &b) {
+  for(int i=0; i<8; i++) {
+    CALL(b, b.printer.printf("%d x Item %02d\n", 1 + i % 3, i));
+  }
+  CALL(b, b.printer.feed(3));
+}
+
+static void ticketQueued(Bench &b) {
+  b.printer.setAsync();
+  ticket(b);
+}
+
+// The same receipt printed from a template recorded once (outside the
+// timing), each line's price filled into a slot.
+static void templated(Bench &b) {
+  static Thermal_TemplateBuilder builder;
+  static Thermal_Template        tpl;
+  static char                    prices[60][8];
+  static const char             *values[60];
+  if(!tpl.segments()) {
+    for(int i=0; i<60; i++) {
+      builder.printer().beginBatch(); // One frame per line
+      builder.printer().printf("Item %02d ............... $", i);
+      builder.slot(5, 'R');
+      builder.printer().write("\n");
+      builder.printer().endBatch();
+    }
+    builder.printer().feed(3);
+    size_t len;
+    const uint8_t *image = builder.finish(&len);
+    tpl.open(image, len);
+  }
+  for(int i=0; i<60; i++) {
+    snprintf(prices[i], sizeof(prices[i]), "%d.%02d",
+      (i * 37) % 50, (i * 13) % 100);
+    values[i] = prices[i];
+  }
+  CALL(b, b.printer.printTemplate(&tpl, values, 60));
+}
+
+// The same receipt sent a character at a time.
+static void bytewise(Bench &b) {
+  char line[40];
+  for(int i=0; i<60; i++) {
+    snprintf(line, sizeof(line), "Item %02d ............... $%2d.%02d\n",
+      i, (i * 37) % 50, (i * 13) % 100);
+    for(char *c = line; *c; c++) CALL(b, b.printer.write(*c));
+  }
+  CALL(b, b.printer.feed(3));
+}
+
+// Two-column price table laid out by printRow(), some names wrapping.
+static void table(Bench &b) {
+  static const Thermal_Column cols[] = { { 24, 'L' }, { 8, 'R' } };
+  static const char *names[] = { "Coffee", "Blueberry muffin",
+    "Breakfast sandwich with egg, cheese and bacon", "Orange juice" };
+  char price[8];
+  for(int i=0; i<30; i++) {
+    snprintf(price, sizeof(price), "$%d.%02d", (i * 37) % 50, (i * 13) % 100);
+    const char *cells[] = { names[i % 4], price };
+    CALL(b, b.printer.printRow(cols, 2, cells));
+  }
+  CALL(b, b.printer.feed(3));
+}
+
+// Multilingual receipt lines, needing several code pages.
+static const char *utf8Lines[] = {
+  "Caf\xc3\xa9 cr\xc3\xa8" "me br\xc3\xbbl\xc3\xa9" "e  \xe2\x82\xac" "4,50\n",
+  "Stra\xc3\x9f" "e  K\xc3\xa4se  M\xc3\xbcsli  \xe2\x82\xac" "3,20\n",
+  "\xd0\xa7\xd0\xb0\xd0\xb9 \xd1\x87\xd1\x91\xd1\x80\xd0\xbd\xd1\x8b\xd0\xb9"
+    "  120 \xd1\x80\xd1\x83\xd0\xb1\n",
+  "\xce\x9a\xce\xb1\xcf\x86\xce\xad\xcf\x82  2,00\n",
+  "Total: 12,90 \xe2\x82\xac  Danke sch\xc3\xb6n!\n",
+};
+
+static void utf8(Bench &b) {
+  for(int i=0; i<40; i++)
+    CALL(b, b.printer.writeUTF8(utf8Lines[i % 5]));
+  CALL(b, b.printer.feed(3));
+}
+
+// Receipt that changes style every few words, as menus and tickets do.
+static void styled(Bench &b) {
+  static const char *words[] = { "Total ", "Tax ", "Qty ", "Sub ", "Due " };
+  for(int i=0; i<40; i++) {
+    CALL(b, b.printer.justify("LCR"[i % 3]));
+    if(i % 5 == 0) CALL(b, b.printer.setSize('M'));
+    for(int w=0; w<5; w++) {
+      switch((i + w) % 4) {
+       case 0: CALL(b, b.printer.boldOn());      break;
+       case 1: CALL(b, b.printer.underlineOn()); break;
+       case 2: CALL(b, b.printer.inverseOn());   break;
+       case 3: CALL(b, b.printer.normal());      break;
+      }
+      text(b, words[w]);
+      CALL(b, b.printer.boldOff());
+      CALL(b, b.printer.underlineOff());
+      CALL(b, b.printer.inverseOff());
+    }
+    text(b, "\n");
+    if(i % 5 == 0) CALL(b, b.printer.setSize('S'));
+  }
+  CALL(b, b.printer.feed(3));
+}
+
+// Gray test image: a diagonal ramp with a white band and a dark disc.
+static void grayImage(uint8_t *gray, int w, int h) {
+  for(int y=0; y<h; y++) {
+    for(int x=0; x<w; x++) {
+      int v  = ((x + y) * 255) / (w + h);
+      int dx = x - w / 2, dy = y - h / 2;
+      if((y % 64) < 8)                       v = 255;
+      if(dx * dx + dy * dy < (h * h) / 16)   v = 30;
+      gray[y * w + x] = v;
+    }
+  }
+}
+
+// Full-width dithered photo.
+static void bitmap(Bench &b) {
+  static uint8_t gray[384 * 320], bits[48 * 320];
+  grayImage(gray, 384, 320);
+  Thermal_ImageDither(gray, 384, 320, 384, bits, THERMAL_DITHER_BAYER);
+  CALL(b, b.printer.printBitmap(384, 320, bits));
+  CALL(b, b.printer.feed(2));
+}
+
+// Shipping label: big centered heading, small logo, address, footer.
+static void label(Bench &b) {
+  static uint8_t gray[128 * 64], bits[16 * 64];
+  grayImage(gray, 128, 64);
+  Thermal_ImageDither(gray, 128, 64, 128, bits, THERMAL_DITHER_THRESHOLD);
+
+  CALL(b, b.printer.justify('C'));
+  CALL(b, b.printer.setSize('L'));
+  text(b, "PRIORITY\n");
+  CALL(b, b.printer.setSize('S'));
+  CALL(b, b.printer.printBitmap(128, 64, bits));
+  CALL(b, b.printer.justify('L'));
+  CALL(b, b.printer.boldOn());
+  text(b, "SHIP TO:\n");
+  CALL(b, b.printer.boldOff());
+  text(b, "Jane Doe\n1234 Example Street\nSpringfield, ST 00000\n");
+  CALL(b, b.printer.feedRows(12));
+  CALL(b, b.printer.underlineOn());
+  text(b, "Order 2201-7781  Box 1 of 1\n");
+  CALL(b, b.printer.underlineOff());
+  CALL(b, b.printer.feed(3));
+}
+
+// Order numbers as CODE128 barcodes, drawn by the printer.
+static void barcodes(Bench &b) {
+  char number[16];
+  for(int i=0; i<5; i++) {
+    snprintf(number, sizeof(number), "ORD-%06d", 4711 + i * 37);
+    CALL(b, b.printer.printBarcode(number, CODE128));
+  }
+  CALL(b, b.printer.feed(3));
+}
+
+// Receipt links as QR codes; three payloads, repeating, so most come
+// from the symbol cache.
+static const char *qrLinks[] = {
+  "https://example.com/r/4711?t=12",
+  "https://example.com/r/4748?t=7",
+  "https://example.com/r/4785?t=3",
+};
+
+// With a symbol cache, so each link is only encoded once.
+static void qr(Bench &b) {
+  static Thermal_QRCache cache;
+  b.printer.setQRCache(&cache);
+  CALL(b, b.printer.justify('C'));
+  for(int i=0; i<6; i++) CALL(b, b.printer.printQR(qrLinks[i % 3]));
+  CALL(b, b.printer.feed(3));
+}
+
+// The same symbols shipped the old way: rendered elsewhere to full
+// width bitmaps, which is what the link has to carry.
+static void qrBitmap(Bench &b) {
+  static uint8_t bits[48 * 384];
+  for(int i=0; i<6; i++) {
+    Thermal_QR sym;
+    sym.encode((const uint8_t *)qrLinks[i % 3], strlen(qrLinks[i % 3]));
+    int scale = 6, w = sym.pixels(scale), offset = (384 - w) / 2;
+    for(int y=0; y<w; y++) sym.row(y, scale, bits + y * 48, offset);
+    CALL(b, b.printer.printBitmap(384, w, bits));
+  }
+  CALL(b, b.printer.feed(3));
+}
+
+static const struct {
+  const char *name;
+  void      (*run)(Bench &b);
+} workloads[] = {
+  { "receipt", receipt },
+  { "async",   queued  },
+  { "ticket",  ticket  },
+  { "ticketq", ticketQueued },
+  { "template", templated },
+  { "bytewise", bytewise },
+  { "table",   table   },
+  { "utf8",    utf8    },
+  { "styled",  styled  },
+  { "bitmap",  bitmap  },
+  { "label",   label   },
+  { "barcode", barcodes },
+  { "qr",      qr      },
+  { "qrbitmap", qrBitmap },
+};
+
+// ----------------------------------------------------------------------
+// Queued output
+
+// Keeps everything written, as the reference for what a port was sent.
+class Capture : public Thermal_NullTransport {
+ public:
+  void write(const uint8_t *buf, size_t len) {
+    data.insert(data.end(), buf, buf + len);
+  }
+  std::vector<uint8_t> data;
+};
+
+static void receiptInto(Thermal_Print &p) {
+  for(int i=0; i<60; i++) {
+    p.printf("Item %02d ............... $%2d.%02d\n",
+      i, (i * 37) % 50, (i * 13) % 100);
+  }
+  p.feed(3);
+}
+
+// Kitchen ticket 'n' of a stream: 2 to 13 lines.
+static void ticketInto(Thermal_Print &p, int n) {
+  p.printf("Order %d\n", n);
+  for(int i=0; i<1 + (n * 7) % 12; i++) {
+    p.printf("%d x Item %02d\n", 1 + i % 3, i);
+  }
+  p.feed(3);
+}
+
+// Queuing changes when bytes go out, never which ones: a receipt, a
+// large heading and a bold ticket must send exactly the same bytes
+// with setAsync() as without.
+static bool queuedSame() {
+  Capture sent[2];
+  for(int async=0; async<2; async++) {
+    Thermal_SimClock clock;
+    Thermal_Print    printer(&sent[async], &clock);
+    printer.begin();
+    if(async) printer.setAsync();
+    receiptInto(printer);
+    printer.setSize('L');
+    printer.write("Kitchen\n");
+    printer.setSize('S');
+    printer.boldOn();
+    ticketInto(printer, 5);
+    printer.boldOff();
+    printer.drain();
+  }
+  bool same = (sent[0].data == sent[1].data);
+
+  if(json) {
+    printf("{\"workload\":\"queued\",\"bytes\":%u,\"same\":%s}\n",
+      (unsigned)sent[1].data.size(), same ? "true" : "false");
+  } else {
+    printf("queued %6u bytes  %s\n", (unsigned)sent[1].data.size(),
+      same ? "same as blocking" : "DIFFERENT");
+  }
+  return same && !sent[0].data.empty();
+}
+
+// ----------------------------------------------------------------------
+// 80 mm printer
+
+// With Thermal_Profile80mm on both ends, a line of the full 48 columns
+// must print as one line, and a 576-dot bitmap must land dot for dot.
+// A build with THERMAL_PROFILE can't switch profiles, so skips this.
+#ifndef THERMAL_PROFILE
+static bool wide() {
+  static uint8_t            bits[72 * 64];
+  Thermal_Emulator          emu(&Thermal_Profile80mm);
+  Thermal_SimClock          clock;
+  Thermal_EmulatorTransport line(emu, clock);
+  Thermal_Print             printer(&line, &clock);
+
+  printer.setProfile(&Thermal_Profile80mm);
+  printer.begin();
+  printer.drain();
+  emu.idleTime();
+  int top = emu.rows();
+  printer.write("Table 12 ....................... 4 covers $86.50\n");
+  printer.drain();
+  emu.idleTime();
+  int text = emu.rows() - top;
+
+  for(int i=0; i<(int)sizeof(bits); i++) bits[i] = (i & 1) ? 0xA5 : 0x3C;
+  top = emu.rows();
+  printer.printBitmap(576, 64, bits);
+  printer.drain();
+  emu.idleTime();
+  bool same = (emu.rows() - top == 64) &&
+    !memcmp(&emu.paper()[top * 72], bits, sizeof(bits));
+
+  if(json) {
+    printf("{\"workload\":\"wide\",\"dots\":%d,\"text_rows\":%d,"
+      "\"bitmap_same\":%s,\"overruns\":%lu}\n", emu.width(), text,
+      same ? "true" : "false", emu.overruns);
+  } else {
+    printf("wide %d dots  48 columns in %d dot rows  bitmap %s  %lu overruns\n",
+      emu.width(), text, same ? "same" : "DIFFERENT", emu.overruns);
+  }
+  return (emu.width() == 576) && (text == 30) && same && !emu.overruns;
+}
+#endif
+
+// ----------------------------------------------------------------------
+// Command batching
+
+// Puts the printer back to defaults and prints a line, with setDefault()
+// sending its ten commands as one batch, then with the same commands
+// called one by one.  Reports the pacing waits and the time from the
+// start of the job to the first printed dot, with each wait waking
+// 100 us late as a host's timers typically do.
+static void batching() {
+  for(int batched=1; batched>=0; batched--) {
+    Thermal_Emulator          emu;
+    BenchClock                clock;
+    Thermal_EmulatorTransport line(emu, clock);
+    Thermal_Print             printer(&line, &clock);
+    printer.begin();
+    printer.drain();
+    emu.idleTime();
+    printer.invalidateState();    // Send every command, not just changes
+    clock.late = 100;
+    unsigned long sleeps = clock.sleeps;
+    uint64_t      start  = clock.time();
+    if(batched) {
+      printer.setDefault();
+    } else {
+      printer.online();
+      printer.justify('L');
+      printer.inverseOff();
+      printer.doubleHeightOff();
+      printer.setLineHeight(30);
+      printer.boldOff();
+      printer.underlineOff();
+      printer.setSize('s');
+      printer.setCharset();
+      printer.setCodePage();
+    }
+    printer.write("Hello\n");
+    printer.drain();
+    emu.idleTime();
+    const char *name = batched ? "batched" : "unbatched";
+    if(json) {
+      printf("{\"workload\":\"setdefault\",\"mode\":\"%s\",\"waits\":%lu,"
+        "\"first_dot_us\":%llu}\n", name, clock.sleeps - sleeps,
+        (unsigned long long)(emu.firstDot - start));
+    } else {
+      printf("setDefault %-9s %3lu waits, first dot after %8llu us\n", name,
+        clock.sleeps - sleeps, (unsigned long long)(emu.firstDot - start));
+    }
+  }
+}
+
+// ----------------------------------------------------------------------
+// Raster elision
+
+// Row source that checks every row is asked for once, in order.
+struct OnceRows {
+  const uint8_t *bits;
+  int            rowBytes, next;
+  bool           ok;
+};
+
+static const uint8_t *onceRow(uint16_t y, uint8_t *, void *ctx) {
+  OnceRows *r = (OnceRows *)ctx;
+  if(y != r->next++) r->ok = false;
+  return r->bits + y * r->rowBytes;
+}
+
+// Bitmap sent without elision: every row in full, in chunks that fit
+// the printer's buffer, each paced for its bytes and dotPrintTime per
+// row.  elision() sets the printer's raster row time to dotPrintTime as
+// well, so the two are paced alike and differ only by what's elided.
+static void fullRaster(Thermal_Print &p, const uint8_t *bits, int w, int h) {
+  static uint8_t buf[4 + 256];
+  unsigned long byteTime = p.getByteTime();
+  int rowBytes = (w + 7) / 8, limit = 256 / rowBytes, n;
+  for(int y=0; y<h; y+=n) {
+    n      = (h - y < limit) ? h - y : limit;
+    buf[0] = 18;                                  // DC2 *
+    buf[1] = '*';
+    buf[2] = n;
+    buf[3] = rowBytes;
+    memcpy(buf + 4, bits + y * rowBytes, n * rowBytes);
+    p.writeEncoded(buf, 4 + n * rowBytes, (4 + n * rowBytes) * byteTime +
+      n * Thermal_Profile58mm.dotPrintTime);
+  }
+}
+
+// A corpus of receipt and label images, each printed in full and with
+// blank rows fed and white row ends trimmed.  Reports bytes and printing
+// time saved; the paper must come out the same.
+static bool elision() {
+  static uint8_t gray[384 * 320], bits[48 * 400];
+  bool ok = true;
+
+  for(int image=0; image<4; image++) {
+    const char *name;
+    int         w = 384, h;
+    memset(bits, 0, sizeof(bits));
+    switch(image) {
+     case 0:                                      // Dithered photo
+      name = "photo";
+      h    = 320;
+      grayImage(gray, w, h);
+      Thermal_ImageDither(gray, w, h, w, bits, THERMAL_DITHER_BAYER);
+      break;
+     case 1: {                                    // Logo, left of a header
+      name = "logo";
+      h    = 96;
+      grayImage(gray, 128, 64);
+      static uint8_t logo[16 * 64];
+      Thermal_ImageDither(gray, 128, 64, 128, logo, THERMAL_DITHER_THRESHOLD);
+      for(int y=0; y<64; y++) memcpy(bits + (y + 16) * 48, logo + y * 16, 16);
+      break;
+     }
+     case 2: {                                    // Centred QR code
+      name = "qr";
+      Thermal_QR sym;
+      sym.encode((const uint8_t *)qrLinks[0], strlen(qrLinks[0]));
+      h = sym.pixels(6);
+      for(int y=0; y<h; y++) sym.row(y, 6, bits + y * 48, (384 - h) / 2);
+      break;
+     }
+     default:                                     // Label: text blocks
+      name = "label";
+      h    = 400;
+      for(int y=0; y<h; y++) {
+        if((y % 50) >= 24) continue;              // Gaps between lines
+        int len = 8 + (y / 50) * 5;               // Ragged right edge
+        for(int x=0; x<len; x++) bits[y * 48 + x] = (x % 3) ? 0x7E : 0;
+      }
+      break;
+    }
+
+    Thermal_Emulator emu[2];
+    unsigned long    bytes[2];
+    uint64_t         mech[2];
+    OnceRows         rows = { bits, 48, 0, true };
+    for(int elide=0; elide<2; elide++) {
+      BenchClock                clock;
+      Thermal_EmulatorTransport line(emu[elide], clock);
+      Thermal_Print             printer(&line, &clock);
+      printer.begin();
+      printer.setDensityTimes(Thermal_Profile58mm.dotPrintTime, 0);
+      printer.drain();
+      uint64_t      start = emu[elide].idleTime();
+      unsigned long sent  = emu[elide].bytesReceived;
+      if(elide) printer.printBitmap(w, h, onceRow, &rows);
+      else      fullRaster(printer, bits, w, h);
+      printer.drain();
+      bytes[elide] = emu[elide].bytesReceived - sent;
+      mech[elide]  = emu[elide].idleTime() - start;
+    }
+    bool same = (emu[0].paper() == emu[1].paper()) && rows.ok &&
+      (rows.next == h) && !emu[0].overruns && !emu[1].overruns;
+    ok = ok && same;
+    if(json) {
+      printf("{\"workload\":\"elision\",\"image\":\"%s\",\"bytes_full\":%lu,"
+        "\"bytes\":%lu,\"mech_us_full\":%llu,\"mech_us\":%llu,"
+        "\"identical\":%s}\n", name, bytes[0], bytes[1],
+        (unsigned long long)mech[0], (unsigned long long)mech[1],
+        same ? "true" : "false");
+    } else {
+      printf("elision %-6s %6lu -> %6lu bytes (%4.1f%% saved) %10llu -> %10llu"
+        " us (%4.1f%% saved)%s\n", name, bytes[0], bytes[1],
+        100.0 * ((double)bytes[0] - bytes[1]) / bytes[0],
+        (unsigned long long)mech[0], (unsigned long long)mech[1],
+        100.0 * ((double)mech[0] - mech[1]) / mech[0],
+        same ? "" : "  DIFFERENT");
+    }
+  }
+  return ok;
+}
+
+// ----------------------------------------------------------------------
+// Image processing throughput
+
+// Dithers noise with 'kernel' and with the scalar kernel at widths that
+// end partway through a vector or a byte, rows starting a stride apart
+// that isn't a whole vector either.  Returns the first width whose
+// packed output differs or runs past its end, or 0 if none does.
+static int kernelMismatch(int method, int kernel) {
+  static const int widths[] = { 1, 7, 9, 15, 17, 31, 33, 63, 65, 127,
+    129, 383 };
+  static uint8_t gray[387 * 24], want[48 * 24 + 1], got[48 * 24 + 1];
+  uint32_t seed = 1;
+  for(int i=0; i<(int)sizeof(gray); i++) {
+    seed    = seed * 1103515245 + 12345;
+    gray[i] = seed >> 24;
+  }
+  for(int i=0; i<(int)(sizeof(widths) / sizeof(widths[0])); i++) {
+    int w = widths[i], len = (w + 7) / 8 * 24;
+    memset(want, 0x00, sizeof(want));
+    memset(got , 0xFF, sizeof(got));
+    Thermal_ImageDither(gray, w, 24, 387, want, method, 100,
+      THERMAL_KERNEL_SCALAR);
+    Thermal_ImageDither(gray, w, 24, 387, got, method, 100, kernel);
+    if(memcmp(want, got, len) || (got[len] != 0xFF)) return w;
+  }
+  return 0;
+}
+
+static bool dither() {
+  static const char *methods[] = { "threshold", "bayer", "floyd" };
+  static const char *kernels[] = { "auto", "scalar", "sse2", "avx2", "neon" };
+  static uint8_t gray[384 * 1024], bits[48 * 1024];
+  bool           ok = true;
+  grayImage(gray, 384, 1024);
+
+  for(int m=THERMAL_DITHER_THRESHOLD; m<=THERMAL_DITHER_FLOYD; m++) {
+    for(int k=THERMAL_KERNEL_SCALAR; k<=THERMAL_KERNEL_NEON; k++) {
+      if(!Thermal_ImageKernelAvailable(k)) continue;
+      // Error diffusion is serial along each row, so it always runs
+      // scalar; the vector kernels would just repeat its figure.
+      if((m == THERMAL_DITHER_FLOYD) && (k != THERMAL_KERNEL_SCALAR)) continue;
+      int      reps = 0;
+      uint64_t t0   = hostNanos(), t;
+      do {
+        Thermal_ImageDither(gray, 384, 1024, 384, bits, m, 128, k);
+        reps++;
+      } while(((t = hostNanos() - t0) < 200000000ULL) || (reps < 3));
+      double mps = (384.0 * 1024 * reps) / (t / 1000.0);
+      int    bad = (k == THERMAL_KERNEL_SCALAR) ? 0 : kernelMismatch(m, k);
+      if(bad) ok = false;
+      if(json) {
+        printf("{\"workload\":\"dither\",\"method\":\"%s\","
+          "\"kernel\":\"%s\",\"mpix_s\":%.1f,\"mismatch_width\":%d}\n",
+          methods[m], kernels[k], mps, bad);
+      } else if(k == THERMAL_KERNEL_SCALAR) {
+        printf("dither %-9s %-6s %8.1f MP/s\n", methods[m], kernels[k], mps);
+      } else if(bad) {
+        printf("dither %-9s %-6s %8.1f MP/s  DIFFERS from scalar at "
+          "width %d\n", methods[m], kernels[k], mps, bad);
+      } else {
+        printf("dither %-9s %-6s %8.1f MP/s  same as scalar\n", methods[m],
+          kernels[k], mps);
+      }
+    }
+  }
+  return ok;
+}
+
+// UTF-8 conversion cost: the receipt lines above, printed to nowhere on
+// a simulated clock so only the library's own work is timed.
+static void transcode() {
+  Thermal_SimClock      clock;
+  Thermal_NullTransport sink;
+  Thermal_Print         printer(&sink, &clock);
+  size_t                bytes = 0;
+  int                   reps  = 0;
+  uint64_t              t0    = hostNanos(), t;
+  printer.begin();
+  do {
+    for(int i=0; i<5; i++) bytes += printer.writeUTF8(utf8Lines[i]);
+    reps++;
+  } while(((t = hostNanos() - t0) < 200000000ULL) || (reps < 3));
+  double mbs = bytes / (t / 1000.0);
+  if(json) {
+    printf("{\"workload\":\"transcode\",\"mb_s\":%.2f}\n", mbs);
+  } else {
+    printf("transcode %21.2f MB/s\n", mbs);
+  }
+}
+
+// QR generation cost per symbol, fresh and from the cache, and what a
+// symbol costs on the link as its payload versus as a full-width bitmap.
+// Then the same symbols through printQR() with and without a cache,
+// which must send the same bytes.
+static bool qrCost() {
+  static const char *levels = "LMQH";
+  for(int e=THERMAL_QR_ECC_L; e<=THERMAL_QR_ECC_H; e++) {
+    Thermal_QR sym;
+    int        reps = 0;
+    uint64_t   t0   = hostNanos(), t;
+    do {
+      const char *link = qrLinks[reps % 3];
+      sym.encode((const uint8_t *)link, strlen(link), e);
+      reps++;
+    } while(((t = hostNanos() - t0) < 200000000ULL) || (reps < 3));
+    double us = t / 1000.0 / reps;
+
+    Thermal_QRCache cache;
+    int             hits = 0;
+    t0 = hostNanos();
+    do {
+      const char *link = qrLinks[hits % 3];
+      cache.get((const uint8_t *)link, strlen(link), e);
+      hits++;
+    } while(((t = hostNanos() - t0) < 200000000ULL) || (hits < 3));
+    double cached = t / 1000.0 / hits;
+
+    size_t payload = strlen(qrLinks[0]);
+    size_t bitmap  = 48 * sym.pixels(6);
+    if(json) {
+      printf("{\"workload\":\"qrgen\",\"ecc\":\"%c\",\"version\":%d,"
+        "\"encode_us\":%.2f,\"cached_us\":%.3f,\"payload_bytes\":%u,"
+        "\"bitmap_bytes\":%u}\n", levels[e], sym.getVersion(), us, cached,
+        (unsigned)payload, (unsigned)bitmap);
+    } else {
+      printf("qr %c v%-2d encode %8.2f us  cached %6.3f us  link %u vs %u"
+        " bytes\n", levels[e], sym.getVersion(), us, cached,
+        (unsigned)payload, (unsigned)bitmap);
+    }
+  }
+
+  Capture         sent[2];
+  Thermal_QRCache cache;
+  for(int cached=0; cached<2; cached++) {
+    Thermal_SimClock clock;
+    Thermal_Print    printer(&sent[cached], &clock);
+    if(cached) printer.setQRCache(&cache);
+    printer.begin();
+    for(int i=0; i<6; i++) printer.printQR(qrLinks[i % 3]);
+    printer.drain();
+  }
+  bool same = (sent[0].data == sent[1].data) && (cache.hits == 3);
+  if(json) {
+    printf("{\"workload\":\"qrcache\",\"same\":%s,\"hits\":%lu,"
+      "\"printer_bytes\":%u,\"cache_bytes\":%u}\n", same ? "true" : "false",
+      cache.hits, (unsigned)sizeof(Thermal_Print),
+      (unsigned)sizeof(Thermal_QRCache));
+  } else {
+    printf("qr cache %s  %lu hits  printer %u bytes, cache %u more\n",
+      same ? "same output" : "DIFFERENT", cache.hits,
+      (unsigned)sizeof(Thermal_Print), (unsigned)sizeof(Thermal_QRCache));
+  }
+  return same;
+}
+
+// ----------------------------------------------------------------------
+// Two printers on one controller
+
+// Customer copy and kitchen ticket for the same order.
+static void order(char *customer, char *kitchen, size_t size) {
+  size_t c = 0, k = 0;
+  for(int i=0; i<20; i++) {
+    c += snprintf(customer + c, size - c, "Item %02d ............... $%2d.%02d\n",
+      i, (i * 37) % 50, (i * 13) % 100);
+    k += snprintf(kitchen + k, size - k, "%d x Item %02d\n", 1 + i % 3, i);
+  }
+  snprintf(customer + c, size - c, "\n\n\n");
+  snprintf(kitchen + k, size - k, "\n\n\n");
+}
+
+// Time until both printers of a station are done, with the two tickets
+// sent one after the other and then interleaved by Thermal_Scheduler.
+static void station() {
+  static char customer[1024], kitchen[1024];
+  order(customer, kitchen, sizeof(customer));
+
+  for(int scheduled=0; scheduled<2; scheduled++) {
+    Thermal_Emulator          emu[2];
+    BenchClock                clock;
+    Thermal_EmulatorTransport line0(emu[0], clock), line1(emu[1], clock);
+    Thermal_Print             p0(&line0, &clock), p1(&line1, &clock);
+    p0.begin();
+    p1.begin();
+    p0.drain();
+    p1.drain();
+    uint64_t start = clock.time();
+    if(scheduled) {
+      Thermal_Scheduler sched;
+      Thermal_TextJob   job0 = { customer }, job1 = { kitchen };
+      sched.submit(&p0, Thermal_TextJob::step, &job0);
+      sched.submit(&p1, Thermal_TextJob::step, &job1);
+      sched.run();
+    } else {
+      p0.write(customer);
+      p1.write(kitchen);
+    }
+    p0.drain();
+    p1.drain();
+    uint64_t t0 = emu[0].idleTime(), t1 = emu[1].idleTime();
+    uint64_t done = ((t0 > t1) ? t0 : t1) - start;
+    unsigned long lost = emu[0].overruns + emu[1].overruns;
+    const char *name = scheduled ? "scheduled" : "sequential";
+    if(json) {
+      printf("{\"workload\":\"station\",\"mode\":\"%s\",\"mech_us\":%llu,"
+        "\"overruns\":%lu}\n", name, (unsigned long long)done, lost);
+    } else {
+      printf("station %-10s %12llu us  %lu overruns\n", name,
+        (unsigned long long)done, lost);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------
+// Two-core pipeline
+
+// The receipt printed directly, then through a pipeline whose engine
+// thread owns the emulator and its clock.  Reports the time the
+// application spent per call, which no longer includes pacing waits.
+static bool pipelined() {
+  uint64_t mech[2], call[2];
+  unsigned long bytes[2], lost[2];
+
+  for(int piped=0; piped<2; piped++) {
+    Thermal_Emulator          emu;
+    Thermal_SimClock          clock;
+    Thermal_EmulatorTransport line(emu, clock);
+    Thermal_Pipeline          pipe(&line, &clock);
+    Thermal_Print             printer(piped ? pipe.transport() : &line,
+                                piped ? pipe.clock() : &clock);
+    printer.begin();
+    if(piped) pipe.launch();
+    uint64_t t0 = hostNanos();
+    for(int i=0; i<60; i++) {
+      printer.printf("Item %02d ............... $%2d.%02d\n",
+        i, (i * 37) % 50, (i * 13) % 100);
+    }
+    printer.feed(3);
+    printer.drain();
+    call[piped] = (hostNanos() - t0) / 61;
+    if(piped) {
+      pipe.wait(pipe.mark());
+      pipe.stop();
+    }
+    mech[piped]  = emu.idleTime();
+    bytes[piped] = emu.bytesReceived;
+    lost[piped]  = emu.overruns;
+  }
+  bool same = (mech[0] == mech[1]) && (bytes[0] == bytes[1]);
+  for(int piped=0; piped<2; piped++) {
+    const char *name = piped ? "pipelined" : "direct";
+    if(json) {
+      printf("{\"workload\":\"pipeline\",\"mode\":\"%s\",\"bytes\":%lu,"
+        "\"mech_us\":%llu,\"call_ns_mean\":%llu,\"overruns\":%lu}\n", name,
+        bytes[piped], (unsigned long long)mech[piped],
+        (unsigned long long)call[piped], lost[piped]);
+    } else {
+      printf("pipeline %-9s %6lu bytes %12llu us %9llu ns/call %lu overruns\n",
+        name, bytes[piped], (unsigned long long)mech[piped],
+        (unsigned long long)call[piped], lost[piped]);
+    }
+  }
+  return same && !lost[0] && !lost[1];
+}
+
+// Checks that bytes come out in order and that each mark is reached
+// right after the bytes queued before it.
+class CheckTransport : public Thermal_NullTransport {
+ public:
+  CheckTransport() { received = errors = 0; }
+  void write(const uint8_t *buf, size_t len) {
+    for(size_t i=0; i<len; i++) {
+      if(buf[i] != (uint8_t)(received++ * 7)) errors++;
+    }
+  }
+  uint64_t      received;
+  unsigned long errors;
+  uint64_t      expect[1 << 16]; // Bytes before each mark
+};
+
+static void checkMark(uint32_t id, void *ctx) {
+  CheckTransport *check = (CheckTransport *)ctx;
+  if(check->received != check->expect[id & 0xFFFF]) check->errors++;
+}
+
+// Random runs of bytes, delays and marks from this thread while the
+// engine thread consumes them.
+static bool stress() {
+  static CheckTransport check;
+  Thermal_SimClock      clock;
+  Thermal_Pipeline      pipe(&check, &clock);
+  Thermal_Clock        *timeline = pipe.clock();
+  uint64_t              sent = 0;
+  uint32_t              seed = 1, id = 0;
+  uint8_t               buf[300];
+
+  pipe.onMark(checkMark, &check);
+  pipe.launch();
+  uint64_t t0 = hostNanos();
+  for(int i=0; i<100000; i++) {
+    seed = seed * 1103515245 + 12345;
+    size_t len = (seed >> 16) % sizeof(buf);
+    for(size_t j=0; j<len; j++) buf[j] = (uint8_t)(sent++ * 7);
+    pipe.transport()->write(buf, len);
+    if(seed & 0x100) timeline->sleepMicros(seed >> 24);
+    if(!(seed & 0x3000)) {
+      check.expect[(id + 1) & 0xFFFF] = sent;
+      id = pipe.mark();
+      if(!(seed & 0x1C000)) pipe.wait(id);
+    }
+  }
+  check.expect[(id + 1) & 0xFFFF] = sent;
+  pipe.wait(pipe.mark());
+  double secs = (hostNanos() - t0) / 1e9;
+  pipe.stop();
+  bool ok = !check.errors && (check.received == sent);
+  if(json) {
+    printf("{\"workload\":\"pipestress\",\"bytes\":%llu,\"marks\":%u,"
+      "\"mb_s\":%.1f,\"errors\":%lu}\n", (unsigned long long)sent, id,
+      sent / secs / 1e6, check.errors);
+  } else {
+    printf("pipeline stress %llu bytes %u marks %8.1f MB/s %lu errors\n",
+      (unsigned long long)sent, id, sent / secs / 1e6, check.errors);
+  }
+  return ok;
+}
+
+// ----------------------------------------------------------------------
+// Spooler
+
+// Counts the lines a printer is given.
+class LineCounter : public Thermal_NullTransport {
+ public:
+  LineCounter() { lines = bytes = 0; }
+  void write(const uint8_t *buf, size_t len) {
+    for(size_t i=0; i<len; i++) lines += (buf[i] == '\n');
+    bytes += len;
+  }
+  unsigned long lines, bytes;
+};
+
+static void order(Thermal_Print &p, int n, int lines) {
+  p.printf("Order %d\n", n);
+  for(int i=1; i<lines; i++) p.printf("%d x Item %02d ......... $%d.%02d\n",
+    1 + i % 3, i, (i * 37) % 50, (i * 13) % 100);
+}
+
+// Runs the spool until everything queued has printed.
+static void spoolDrain(Thermal_Spool &spool, Thermal_SimClock &clock) {
+  while(!spool.idle()) {
+    uint32_t wait = spool.poll();
+    if(wait) clock.sleepMicros(wait);
+  }
+}
+
+// Orders arrive in bursts of ten while the spool prints; if it's full,
+// the producer polls it and tries the same order again until there's
+// room.  Enqueue latency counts every endJob() call an order took.
+static bool spoolRush(const char *path) {
+  LineCounter       line;
+  Thermal_SimClock  clock;
+  Thermal_Print     printer(&line, &clock);
+  Thermal_SpoolFile store(path, 64 * 1024);
+  Thermal_Spool     spool(&store, &printer);
+  uint64_t          enqueue = 0, enqueueMax = 0;
+  unsigned long     full = 0;
+  const int         jobs = 300;
+
+  printer.begin();
+  if(!spool.begin()) return false;
+  uint64_t t0 = hostNanos();
+  for(int n=0; n<jobs; n++) {
+    uint64_t took = 0;
+    order(spool.job(), n, 12);
+    for(;;) {
+      uint64_t t = hostNanos();
+      uint32_t id = spool.endJob();
+      took += hostNanos() - t;
+      if(id) {
+        enqueue += took;
+        if(took > enqueueMax) enqueueMax = took;
+        break;
+      }
+      full++;
+      for(int i=0; i<20; i++) {
+        uint32_t wait = spool.poll();
+        if(wait) clock.sleepMicros(wait);
+      }
+    }
+    if(n % 10 == 9) {
+      for(int i=0; i<5; i++) {
+        uint32_t wait = spool.poll();
+        if(wait) clock.sleepMicros(wait);
+      }
+    }
+  }
+  spoolDrain(spool, clock);
+  double secs = (hostNanos() - t0) / 1e9;
+  double amp  = (double)spool.bytesWritten / line.bytes;
+  if(json) {
+    printf("{\"workload\":\"spool\",\"jobs\":%d,\"enqueue_ns_mean\":%.0f,"
+      "\"enqueue_ns_max\":%llu,\"jobs_s\":%.0f,\"write_amp\":%.2f,"
+      "\"syncs\":%lu,\"full\":%lu}\n", jobs, (double)enqueue / jobs,
+      (unsigned long long)enqueueMax, jobs / secs, amp, spool.syncs, full);
+  } else {
+    printf("spool %d jobs  enqueue %.0f ns (max %llu)  %.0f jobs/s  "
+      "write amp %.2f  %lu syncs  %lu full\n", jobs, (double)enqueue / jobs,
+      (unsigned long long)enqueueMax, jobs / secs, amp, spool.syncs, full);
+  }
+  return line.lines == (unsigned long)jobs * 12;
+}
+
+// Five jobs queued, a reset partway through the second, then the rest
+// after recovery.  Lines printed twice must be under a checkpoint's
+// worth, and none may be missing.  With 'async' the printer queues its
+// output, and whatever is still queued at the reset is lost with it.
+static bool spoolResume(const char *path, bool async) {
+  const unsigned long expect = 5 * 20;
+  unsigned long       before, after;
+  {
+    LineCounter       line;
+    Thermal_SimClock  clock;
+    Thermal_Print     printer(&line, &clock);
+    Thermal_SpoolFile store(path, 64 * 1024);
+    Thermal_Spool     spool(&store, &printer);
+    printer.begin();
+    if(async) printer.setAsync();
+    spool.begin();
+    for(int n=0; n<5; n++) {
+      order(spool.job(), n, 20);
+      spool.endJob();
+    }
+    while(line.lines < 33) {
+      uint32_t wait = spool.poll();
+      if(wait) clock.sleepMicros(wait);
+    }
+    before = line.lines;
+  }                                // Reset: everything in RAM is lost
+  LineCounter       line;
+  Thermal_SimClock  clock;
+  Thermal_Print     printer(&line, &clock);
+  Thermal_SpoolFile store(path, 64 * 1024);
+  Thermal_Spool     spool(&store, &printer);
+  printer.begin();
+  bool ok = spool.begin();
+  unsigned int left = spool.queued();
+  spoolDrain(spool, clock);
+  after = line.lines;
+  long twice = (long)(before + after) - (long)expect;
+  if(json) {
+    printf("{\"workload\":\"spoolresume\",\"async\":%s,"
+      "\"jobs_left\":%u,\"lines_before\":%lu,\"lines_after\":%lu,"
+      "\"reprinted\":%ld}\n", async ? "true" : "false", left, before, after,
+      twice);
+  } else {
+    printf("spool reset after %lu lines%s, %u jobs left, %lu lines after,"
+      " %ld reprinted\n", before, async ? " queued" : "", left, after,
+      twice);
+  }
+  return ok && (twice >= 0) && (twice <= THERMAL_SPOOL_CHECKPOINT);
+}
+
+static bool spooler() {
+  char path[] = "/tmp/thermal_spoolXXXXXX";
+  int  fd     = mkstemp(path);
+  if(fd < 0) return false;
+  close(fd);
+  bool ok = spoolRush(path);
+  unlink(path);
+  strcpy(path, "/tmp/thermal_spoolXXXXXX");
+  if((fd = mkstemp(path)) < 0) return false;
+  close(fd);
+  ok = spoolResume(path, false) && ok;
+  unlink(path);
+  strcpy(path, "/tmp/thermal_spoolXXXXXX");
+  if((fd = mkstemp(path)) < 0) return false;
+  close(fd);
+  ok = spoolResume(path, true) && ok;
+  unlink(path);
+  return ok;
+}
+
+// ----------------------------------------------------------------------
+// Linux serial port
+
+// The same short job, queued, with a paper check nobody answers.
+static bool serialJob(Thermal_Print &p) {
+  p.begin();
+  p.setTimes(3000, 210);
+  p.setAsync();
+  p.write("Order 1042\n2 x Soup\n1 x Salad\n");
+  bool paper = p.hasPaper(); // Must time out, not hang
+  p.feed(2);
+  p.drain();
+  return paper;
+}
+
+// Thermal_LinuxSerial on the slave side of a pty must deliver to the
+// master exactly what the job produces, and refuse rates termios has
+// no speed for, leaving the rate it had.  A transport without flow
+// control must have it refused too.
+static bool serial() {
+  int m = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if((m < 0) || grantpt(m) || unlockpt(m)) return false;
+  int s = open(ptsname(m), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if(s < 0) return false;
+
+  Capture            ref;
+  Thermal_SimClock   sim;
+  Thermal_Print      model(&ref, &sim);
+  Thermal_LinuxSerial port(s);
+  Thermal_LinuxClock clock;
+  Thermal_Print      printer(&port, &clock);
+  bool ok = serialJob(model) && serialJob(printer);
+
+  std::vector<uint8_t> got;
+  uint8_t              buf[4096];
+  ssize_t              n;
+  while((n = read(m, buf, sizeof(buf))) > 0) got.insert(got.end(), buf,
+    buf + n);
+  bool same = (got == ref.data);
+  bool odd  = !port.begin(12345) && !printer.setBaudRate(12345) &&
+    (printer.getBaudRate() == 19200) && printer.setBaudRate(9600);
+  bool flow = !model.setFlowControl(THERMAL_FLOW_BUSY) &&
+    model.setFlowControl(THERMAL_FLOW_NONE);
+  close(s);
+  close(m);
+
+  if(json) {
+    printf("{\"workload\":\"serial\",\"bytes\":%u,\"same\":%s,"
+      "\"odd_rate_refused\":%s,\"no_flow_refused\":%s}\n",
+      (unsigned)got.size(), same ? "true" : "false", odd ? "true" : "false",
+      flow ? "true" : "false");
+  } else {
+    printf("serial pty %6u bytes  %s  odd rate %s  missing flow control %s\n",
+      (unsigned)got.size(), same ? "same as sent" : "DIFFERENT",
+      odd ? "refused" : "ACCEPTED", flow ? "refused" : "ACCEPTED");
+  }
+  return ok && same && odd && flow;
+}
+
+// ----------------------------------------------------------------------
+// Fleet of printers
+
+// Latest a printer's timer may be handled, in us.  Ordinary scheduling
+// jitter stays well under this; a thread stuck in another printer's
+// job step does not.
+#define FLEET_LATE_MAX 50000
+
+// Speeds the printer model up tenfold, so a job takes a fraction of a
+// second of real time; deadlines come just as often per line.  With a
+// context, a hundredfold.
+static bool fastTimes(Thermal_Print *p, void *ctx) {
+  if(ctx) p->setTimes(300, 21);
+  else    p->setTimes(3000, 210);
+  return false;
+}
+
+// Fake printers: the far ends of ptys, drained by one thread.
+static void drainPtys(std::vector<int> *masters, std::atomic<bool> *done,
+  unsigned long *bytes) {
+  std::vector<struct pollfd> fds(masters->size());
+  uint8_t buf[4096];
+  for(size_t i=0; i<fds.size(); i++) {
+    fds[i].fd     = (*masters)[i];
+    fds[i].events = POLLIN;
+  }
+  while(!done->load()) {
+    if(poll(fds.data(), fds.size(), 20) <= 0) continue;
+    for(size_t i=0; i<fds.size(); i++) {
+      ssize_t n;
+      if(fds[i].revents & POLLIN) {
+        while((n = read(fds[i].fd, buf, sizeof(buf))) > 0) *bytes += n;
+      }
+    }
+  }
+}
+
+// 'printers' ptys each printing a short ticket through a fleet of
+// 'threads' threads.  Or a 3000-character line, at 115200 baud and a
+// faster printer model: one step queueing far more than the TX queue
+// holds, which must wait for room on the fleet's own thread.
+static bool fleet(int printers, int threads, bool longLine=false) {
+  static const char ticket[] =
+    "Order 1042\n2 x Soup\n1 x Salad\n1 x Bread\n3 x Coffee\n\n\n";
+  static char       line[3002];
+  const char       *text = ticket;
+  static int        fast;
+  if(longLine) {
+    memset(line, 'x', 3000);
+    strcpy(line + 3000, "\n");
+    text = line;
+  }
+  std::vector<int>             masters;
+  std::vector<Thermal_Print *> list;
+  std::vector<Thermal_TextJob> jobs(printers);
+  std::atomic<bool>            done(false);
+  unsigned long                bytes = 0;
+  bool                         ok    = true;
+  Thermal_Fleet               *f     = new Thermal_Fleet(threads);
+
+  for(int i=0; i<printers; i++) {
+    int m = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if((m < 0) || grantpt(m) || unlockpt(m)) return false;
+    int s = open(ptsname(m), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(s < 0) return false;
+    masters.push_back(m);
+    masters.push_back(s);          // Slave end closed with the rest
+    list.push_back(f->add(s, longLine ? 115200 : BAUD_RATE));
+  }
+  std::vector<int> ends;
+  for(size_t i=0; i<masters.size(); i+=2) ends.push_back(masters[i]);
+  std::thread reader(drainPtys, &ends, &done, &bytes);
+
+  f->start();
+  uint64_t t0 = hostNanos();
+  for(int i=0; i<printers; i++) {
+    jobs[i].text = text;
+    ok = f->submit(list[i], fastTimes, longLine ? &fast : NULL) && ok;
+    ok = f->submit(list[i], Thermal_TextJob::step, &jobs[i]) && ok;
+  }
+  f->stop();
+  double secs = (hostNanos() - t0) / 1e9;
+  Thermal_FleetStats st;
+  f->getStats(&st);
+  delete f;
+  done.store(true);
+  reader.join();
+  for(size_t i=0; i<masters.size(); i++) close(masters[i]);
+
+  unsigned long n = 0, p99 = 0;
+  for(int b=0; b<THERMAL_FLEET_BUCKETS; b++) {
+    n += st.late[b];
+    if(!p99 && (n * 100 >= st.wakeups * 99)) p99 = 1UL << b;
+  }
+  double cpu  = st.cpuNanos / 1e9 / secs * 100 / printers; // % of a core
+  double mean = st.wakeups ? (double)st.lateTotal / st.wakeups : 0;
+  if(json) {
+    printf("{\"workload\":\"fleet\",\"job\":\"%s\",\"printers\":%d,"
+      "\"threads\":%d,\"cpu_pct_per_printer\":%.3f,\"wakeups\":%lu,"
+      "\"late_us_mean\":%.1f,\"late_us_p99\":%lu,\"late_us_max\":%u,"
+      "\"bytes\":%lu}\n", longLine ? "long" : "ticket", printers, threads,
+      cpu, st.wakeups, mean, p99, st.lateMax, bytes);
+  } else {
+    printf("fleet %-6s %2d printers %d thread%s  cpu %6.3f%%/printer  %5lu "
+      "wakeups  late %6.1f us mean, p99 < %lu, max %u\n",
+      longLine ? "long" : "ticket", printers, threads,
+      (threads > 1) ? "s" : " ", cpu, st.wakeups, mean, p99, st.lateMax);
+  }
+  return ok && (bytes >= (unsigned long)printers * strlen(text)) &&
+    (st.lateMax <= FLEET_LATE_MAX);
+}
+
+// ----------------------------------------------------------------------
+// Job cost estimates
+
+// The receipt's estimate against the emulator, the cost of estimating,
+// then a stream of tickets arriving every 2 s for three printers (one
+// at 9600 baud, one with a slow mechanism), sent either to whichever
+// would finish first or in turn.  Reports when the last is done.
+static bool estimator() {
+  Thermal_Estimator est;
+  Thermal_Cost      cost;
+  Bench             b;
+  receiptInto(b.printer);
+  b.printer.drain();
+  uint64_t      paced = b.clock.time() - b.start; // The library's reckoning
+  uint64_t      mech  = b.emu.idleTime() - b.start;
+  unsigned long bytes = b.emu.bytesReceived - b.bytesStart;
+  est.start();
+  receiptInto(est.printer());
+  est.finish(&cost);
+
+  const int n  = 20000;
+  uint64_t  t0 = hostNanos();
+  for(int i=0; i<n; i++) {
+    est.start();
+    ticketInto(est.printer(), i);
+    est.finish(&cost);
+  }
+  double ns = (double)(hostNanos() - t0) / n;
+  est.start();
+  receiptInto(est.printer());
+  est.finish(&cost);
+
+  Thermal_Estimator fleet[3];
+  fleet[1].printer().setBaudRate(9600);
+  fleet[2].printer().setTimes(60000, 4200);
+  uint64_t done[2];
+  for(int routed=0; routed<2; routed++) {
+    uint64_t busy[3] = { 0, 0, 0 };
+    for(int i=0; i<200; i++) {
+      uint64_t arrive = (uint64_t)i * 2000000, best = 0;
+      int      pick   = i % 3;
+      for(int j=0; j<3; j++) {
+        if(!routed && (j != pick)) continue;
+        Thermal_Cost c;
+        fleet[j].start();
+        ticketInto(fleet[j].printer(), i);
+        fleet[j].finish(&c);
+        uint64_t end = ((busy[j] > arrive) ? busy[j] : arrive) + c.totalTime;
+        if(!best || (end < best)) {
+          best = end;
+          pick = j;
+        }
+      }
+      busy[pick] = best;
+    }
+    done[routed] = 0;
+    for(int j=0; j<3; j++) if(busy[j] > done[routed]) done[routed] = busy[j];
+  }
+
+  if(json) {
+    printf("{\"workload\":\"estimate\",\"bytes\":%u,\"bytes_emulated\":%lu,"
+      "\"send_us\":%llu,\"print_us\":%llu,\"total_us\":%llu,"
+      "\"paced_us\":%llu,\"mech_us_emulated\":%llu,\"peak\":%u,"
+      "\"peak_emulated\":%lu,\"estimate_ns\":%.1f}\n", cost.bytes, bytes,
+      (unsigned long long)cost.sendTime, (unsigned long long)cost.printTime,
+      (unsigned long long)cost.totalTime, (unsigned long long)paced,
+      (unsigned long long)mech, cost.peakOccupancy,
+      (unsigned long)b.emu.peakOccupancy, ns);
+    printf("{\"workload\":\"routing\",\"round_robin_us\":%llu,"
+      "\"routed_us\":%llu}\n", (unsigned long long)done[0],
+      (unsigned long long)done[1]);
+  } else {
+    printf("estimate receipt %6u bytes (emulated %lu), send %llu + print"
+      " %llu = %llu us (paced %llu, emulated %llu), peak buffered %u"
+      " (emulated %lu), %.0f ns per ticket\n", cost.bytes, bytes,
+      (unsigned long long)cost.sendTime, (unsigned long long)cost.printTime,
+      (unsigned long long)cost.totalTime, (unsigned long long)paced,
+      (unsigned long long)mech, cost.peakOccupancy,
+      (unsigned long)b.emu.peakOccupancy, ns);
+    printf("routing 200 tickets  round robin %12llu us  routed %12llu us\n",
+      (unsigned long long)done[0], (unsigned long long)done[1]);
+  }
+  return (cost.totalTime == paced) && (cost.bytes == bytes) &&
+    (cost.peakOccupancy == b.emu.peakOccupancy);
+}
+
+int main(int argc, char **argv) {
+  for(int i=1; i<argc; i++) {
+    if(!strcmp(argv[i], "--json")) {
+      json = true;
+    } else {
+      fprintf(stderr, "Usage: %s [--json]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if(!json) {
+    printf("%-10s %8s %12s %12s %7s %10s %10s %9s %8s\n", "workload",
+      "bytes", "mech_us", "wait_us", "calls", "call_us", "call_max",
+      "call_ns", "overruns");
+  }
+  unsigned long overruns = 0;
+  for(size_t i=0; i<sizeof(workloads) / sizeof(workloads[0]); i++) {
+    Bench *b = new Bench;
+    workloads[i].run(*b);
+    b->report(workloads[i].name);
+    overruns += b->emu.overruns;
+    delete b;
+  }
+  batching();
+  bool ok = dither();
+  transcode();
+  ok = qrCost() && ok;
+  station();
+  ok = queuedSame() && ok;
+#ifndef THERMAL_PROFILE
+  ok = wide() && ok;
+#else
+  printf(json ? "{\"workload\":\"wide\",\"skipped\":true}\n" :
+    "wide skipped: profile fixed at build time\n");
+#endif
+  ok = elision() && ok;
+  ok = pipelined() && ok;
+  ok = stress() && ok;
+  ok = spooler() && ok;
+  ok = serial() && ok;
+  ok = fleet(1, 1) && ok;
+  ok = fleet(8, 1) && ok;
+  ok = fleet(32, 1) && ok;
+  ok = fleet(64, 1) && ok;
+  ok = fleet(64, 4) && ok;
+  ok = fleet(2, 1, true) && ok;
+  ok = estimator() && ok;
+
+  // Lost bytes mean pacing is too aggressive
+  return (overruns || !ok) ? 1 : 0;
+}
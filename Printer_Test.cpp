@@ -24,20 +24,18 @@
 
 Thermal_Print Thermal;
 
-#define UART_ID uart0
-
 int main()
 {
 Thermal.begin();
-uart_puts(UART_ID, "\n\n");
+Thermal.write("\n\n");
 Thermal.inverseOn();
 Thermal.justify('C');
 Thermal.setSize('M');
-uart_puts(UART_ID, "Hello World \n\n\n\n");
+Thermal.write("Hello World \n\n\n\n");
 Thermal.setDefault();
 
-uart_puts(UART_ID, "Follow my insta: \n");
+Thermal.write("Follow my insta: \n");
 Thermal.boldOn();
-uart_puts(UART_ID, "@Engineering_Applied \n\n");
+Thermal.write("@Engineering_Applied \n\n");
 Thermal.boldOff();
 }
@@ -0,0 +1,84 @@
+/*------------------------------------------------------------------------
+  UTF-8 support for the Thermal_Print library: maps Unicode characters
+  to the printer's built-in code pages (selected with ESC t, see
+  setCodePage()).  Thermal_Print::writeUTF8() uses this to print UTF-8
+  text; the functions here are for programs that want to check or
+  convert text themselves.
+
+  Tables are built in for the pages defined below that have a standard
+  definition; the others (MIK, CP755, the Iran, Latvian and Thai pages)
+  are vendor-specific and never picked automatically.  Characters below
+  0x80 are plain ASCII on every page.
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Codepage_H
+#define Thermal_Codepage_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Code pages (ESC t n) for setCodePage()
+#define CODEPAGE_CP437        0 // USA, Standard Europe
+#define CODEPAGE_KATAKANA     1
+#define CODEPAGE_CP850        2 // Multilingual
+#define CODEPAGE_CP860        3 // Portuguese
+#define CODEPAGE_CP863        4 // Canadian-French
+#define CODEPAGE_CP865        5 // Nordic
+#define CODEPAGE_WCP1251      6 // Cyrillic
+#define CODEPAGE_CP866        7 // Cyrillic #2
+#define CODEPAGE_MIK          8 // Cyrillic/Bulgarian
+#define CODEPAGE_CP755        9 // East Europe, Latvian 2
+#define CODEPAGE_IRAN        10
+#define CODEPAGE_CP862       15 // Hebrew
+#define CODEPAGE_WCP1252     16 // Latin 1
+#define CODEPAGE_WCP1253     17 // Greek
+#define CODEPAGE_CP852       18 // Latin 2
+#define CODEPAGE_CP858       19 // Multilingual Latin 1 + Euro
+#define CODEPAGE_IRAN2       20
+#define CODEPAGE_LATVIAN     21
+#define CODEPAGE_CP864       22 // Arabic
+#define CODEPAGE_ISO_8859_1  23 // West Europe
+#define CODEPAGE_CP737       24 // Greek
+#define CODEPAGE_WCP1257     25 // Baltic
+#define CODEPAGE_THAI        26
+#define CODEPAGE_CP720       27 // Arabic
+#define CODEPAGE_CP855       28
+#define CODEPAGE_CP857       29 // Turkish
+#define CODEPAGE_WCP1250     30 // Central Europe
+#define CODEPAGE_CP775       31
+#define CODEPAGE_WCP1254     32 // Turkish
+#define CODEPAGE_WCP1255     33 // Hebrew
+#define CODEPAGE_WCP1256     34 // Arabic
+#define CODEPAGE_WCP1258     35 // Vietnam
+#define CODEPAGE_ISO_8859_2  36 // Latin 2
+#define CODEPAGE_ISO_8859_3  37 // Latin 3
+#define CODEPAGE_ISO_8859_4  38 // Baltic
+#define CODEPAGE_ISO_8859_5  39 // Cyrillic
+#define CODEPAGE_ISO_8859_6  40 // Arabic
+#define CODEPAGE_ISO_8859_7  41 // Greek
+#define CODEPAGE_ISO_8859_8  42 // Hebrew
+#define CODEPAGE_ISO_8859_9  43 // Turkish
+#define CODEPAGE_ISO_8859_15 44 // Latin 3
+#define CODEPAGE_THAI2       45
+#define CODEPAGE_CP856       46
+#define CODEPAGE_CP874       47
+
+// Bit for a page in a set of code pages (uint64_t)
+#define THERMAL_CODEPAGE_BIT(page) (1ULL << (page))
+
+// Every page with a built-in table.
+uint64_t Thermal_CodepagesKnown();
+
+// Pages that can print character 'c' (all pages for ASCII, none for
+// characters no table has).
+uint64_t Thermal_CodepageMask(uint32_t c);
+
+// Byte for character 'c' on code page 'page', or -1 if it has none.
+int Thermal_CodepageByte(uint32_t c, uint8_t page);
+
+// Decodes one character from UTF-8 text at *p (not past 'end') and
+// advances *p past it.  Malformed input yields U+FFFD, one byte at a time.
+uint32_t Thermal_UTF8Decode(const uint8_t **p, const uint8_t *end);
+
+#endif // Thermal_Codepage_H
@@ -0,0 +1,479 @@
+/*------------------------------------------------------------------------
+  Virtual thermal printer; see Thermal_Emulator.h.
+
+  Model: bytes land in a receive buffer of fixed size as they arrive.
+  The mechanism takes bytes out of it whenever it isn't busy printing or
+  feeding; characters are collected into a line and printed as a unit
+  on LF (or when the line is full), and raster rows print one at a time
+  as their data arrives.  A byte arriving to a full buffer is dropped
+  and counted as an overrun, which is what corrupts output on the real
+  thing when the host sends faster than the paper moves.
+
+  Times are in microseconds.  Printing a dot row of text costs
+  dotPrintTime and feeding one costs dotFeedTime; raster rows cost
+  dotFeedTime plus a share of the difference for each heating pass
+  their black dots need, the same shape the library itself assumes.
+  ------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <stdio.h>
+#include "Thermal_Emulator.h"
+
+#define ASCII_TAB '\t'
+#define ASCII_LF  '\n'
+#define ASCII_DLE  16
+#define ASCII_EOT   4
+#define ASCII_DC2  18
+#define ASCII_ESC  27
+#define ASCII_GS   29
+
+#define INVERSE_MASK       (1 << 1) // ESC ! bits
+#define BOLD_MASK          (1 << 3)
+#define DOUBLE_HEIGHT_MASK (1 << 4)
+#define DOUBLE_WIDTH_MASK  (1 << 5)
+#define STRIKE_MASK        (1 << 6)
+#define UNDERLINE_1  (1 << 7)       // Glyph style bits beyond ESC !
+#define UNDERLINE_2  (1 << 0)
+#define BLANK_CELL   (1 << 4)       // Space: nothing but decorations
+
+Thermal_Emulator::Thermal_Emulator(const Thermal_Profile *profile,
+  size_t bufferSize) : profile(profile), bufferSize(bufferSize) {
+  paperDots  = profile->headDots;
+  rowBytes   = paperDots / 8;
+  cellWidth  = profile->fontWidth;
+  cellHeight = profile->fontHeight;
+  raster.resize(rowBytes);
+  setTimes(profile->dotPrintTime, profile->dotFeedTime);
+  reset();
+}
+
+// Print time for one fully-black dot row and feed time for one dot row.
+void Thermal_Emulator::setTimes(unsigned long dotPrint,
+  unsigned long dotFeed) {
+  dotPrintTime = dotPrint;
+  dotFeedTime  = dotFeed;
+  // Spread the print/feed difference over the passes of a solid row at
+  // the power-on heating dots (ESC 7 changes it).
+  unsigned long passes = (paperDots + 95) / 96;
+  rowPassTime = (dotPrint > dotFeed) ? (dotPrint - dotFeed) / passes : 0;
+}
+
+void Thermal_Emulator::reset() {
+  rx.clear();
+  replies.clear();
+  dots.clear();
+  cmd.clear();
+  bytesReceived   = 0;
+  overruns        = 0;
+  unknownCommands = 0;
+  peakOccupancy   = 0;
+  firstOverrun    = 0;
+  firstDot        = 0;
+  busyUntil       = 0;
+  rtState         = 0;
+  powerOn();
+}
+
+// Settings as after power up or ESC @.
+void Thermal_Emulator::powerOn() {
+  line.clear();
+  lineWidth   = 0;
+  printMode   = 0;
+  sizeMode    = 0;
+  justify     = 0;
+  lineHeight  = profile->lineHeight;
+  underline   = 0;
+  inverse     = 0;
+  charSpacing = 0;
+  heatDots    = 11;
+  rasterRows  = 0;
+  rasterWidth = 0;
+  barHeight   = 50;
+  barWidth    = 3;
+  barLabel    = 0;
+}
+
+void Thermal_Emulator::receive(uint8_t c, uint64_t t) {
+  advance(t);
+  bytesReceived++;
+
+  // DLE EOT n is answered on arrival, even while the mechanism is busy;
+  // the bytes still go through the buffer (and the parser ignores them).
+  if(rtState == 2) {
+    switch(c) {
+     case 1: replies.push_back(0x16); break; // Printer: online
+     case 2: replies.push_back(0x12); break; // Offline cause: cover shut
+     case 3: replies.push_back(0x12); break; // Error: none
+     case 4: replies.push_back(0x12); break; // Paper sensor: paper
+    }
+    rtState = 0;
+  } else if(rtState == 1) {
+    rtState = (c == ASCII_EOT) ? 2 : 0;
+  } else if((c == ASCII_DLE) && cmd.empty() && !rasterRows) {
+    rtState = 1;
+  }
+
+  if(rx.size() >= bufferSize) {
+    if(!overruns) firstOverrun = t;
+    overruns++;
+    return;
+  }
+  Pending p = { c, t };
+  rx.push_back(p);
+  if(rx.size() > peakOccupancy) peakOccupancy = rx.size();
+}
+
+// Lets the mechanism work through the buffer until time t.
+void Thermal_Emulator::advance(uint64_t t) {
+  while(!rx.empty() && (busyUntil <= t)) {
+    if(rasterRows) {
+      // A raster row prints once all of its bytes are in.
+      if(rx.size() < rasterWidth) break;
+      uint8_t *row = &raster[0];
+      uint64_t now = rx[rasterWidth - 1].t;
+      if(now < busyUntil) now = busyUntil;
+      if(now > t) break;
+      memset(row, 0, rowBytes);
+      for(int i=0; i<rasterWidth; i++) {
+        if(i < rowBytes) row[i] = rx.front().c;
+        rx.pop_front();
+      }
+      rasterRows--;
+      rasterRow(row, now);
+    } else {
+      uint64_t now = rx.front().t;
+      if(now < busyUntil) now = busyUntil;
+      uint8_t c = rx.front().c;
+      rx.pop_front();
+      execute(c, now);
+    }
+  }
+}
+
+// Time when the mechanism will have finished with everything received.
+uint64_t Thermal_Emulator::idleTime() {
+  advance((uint64_t)-1);
+  return busyUntil;
+}
+
+// DTR goes busy a little before the buffer is actually full.
+bool Thermal_Emulator::busy() {
+  return rx.size() + 32 > bufferSize;
+}
+
+int Thermal_Emulator::read() {
+  if(replies.empty()) return -1;
+  int c = replies.front();
+  replies.pop_front();
+  return c;
+}
+
+// Takes one byte from the buffer: either part of a command being
+// collected, a control character, or a character for the current line.
+void Thermal_Emulator::execute(uint8_t c, uint64_t now) {
+  if(!cmd.empty()) {
+    cmd.push_back(c);
+    size_t len = commandLength();
+    if(len && (cmd.size() >= len)) command(now);
+    return;
+  }
+  switch(c) {
+   case ASCII_ESC:
+   case ASCII_GS:
+   case ASCII_DC2:
+   case ASCII_DLE:
+    cmd.push_back(c);
+    break;
+   case ASCII_LF:
+    printLine(now);
+    break;
+   case ASCII_TAB:
+    do glyph(' ', now); while((lineWidth / cellWidth) & 3);
+    break;
+   case 0xFF: // Wake
+    break;
+   default:
+    if(c >= ' ') glyph(c, now);
+    break;
+  }
+}
+
+// Total length of the command collected in 'cmd' so far, or 0 if it
+// can't be told yet.
+size_t Thermal_Emulator::commandLength() {
+  size_t n = cmd.size();
+  if(n < 2) return 0;
+  uint8_t a = cmd[0], b = cmd[1];
+  if(a == ASCII_ESC) {
+    switch(b) {
+     case '@': return 2;
+     case '7': case '8': return (b == '7') ? 5 : 4;
+     case 'D': return (cmd[n - 1] == 0 && n > 2) ? n : 0; // Up to NUL
+     default:  return 3; // ESC ! a 3 J d - SP R t = v
+    }
+  }
+  if(a == ASCII_GS) {
+    if(b == 'k') {                      // Barcode: GS k m [n] data
+      if(n < 3) return 0;
+      if(cmd[2] < 65) return (cmd[n - 1] == 0 && n > 3) ? n : 0;
+      if(n < 4) return 0;
+      return 4 + cmd[3];
+    }
+    return 3;                           // GS ! B a h w H r
+  }
+  if(a == ASCII_DC2) {
+    switch(b) {
+     case 'T': return 2;
+     case '*': return 4;                // Data follows as raster rows
+     default:  return 3;                // DC2 #
+    }
+  }
+  return 3;                             // DLE EOT n
+}
+
+void Thermal_Emulator::command(uint64_t now) {
+  uint8_t a = cmd[0], b = cmd[1], n = (cmd.size() > 2) ? cmd[2] : 0;
+  if(a == ASCII_ESC) {
+    switch(b) {
+     case '@': endLine(now); powerOn();             break;
+     case '!':                         // Also sets the size, as GS ! does
+      printMode = n;
+      sizeMode  = ((n & DOUBLE_WIDTH_MASK) ? 0x10 : 0) |
+                  ((n & DOUBLE_HEIGHT_MASK) ? 0x01 : 0);
+      break;
+     case 'a': justify = (n > 2) ? 0 : n;              break;
+     case '3': lineHeight = n;                         break;
+     case '-': underline = (n > 2) ? 2 : n;            break;
+     case ' ': charSpacing = n;                        break;
+     case 'J': endLine(now); feedDots(n, now);      break;
+     case 'd': {
+      endLine(now);
+      int pitch = cellHeight * ((sizeMode & 0x0F) + 1);
+      pitch += (lineHeight > cellHeight) ? lineHeight - cellHeight : 0;
+      feedDots(n * pitch, now);
+      break;
+     }
+     case '7': heatDots = n;                           break;
+     case 'v': replies.push_back(0);                   break; // Paper OK
+     case '8': case 'D': case 'R': case 't': case '=': break;
+     default:  unknownCommands++;                      break;
+    }
+  } else if(a == ASCII_GS) {
+    switch(b) {
+     case '!':
+      // This printer ends the current line when the size changes.
+      endLine(now);
+      sizeMode = n;
+      break;
+     case 'B': inverse = n & 1;                        break;
+     case 'r': replies.push_back(0);                   break;
+     case 'h': barHeight = n;                          break;
+     case 'w': barWidth  = n;                          break;
+     case 'H': barLabel  = n;                          break;
+     case 'k': barcode(now);                           break;
+     case 'a':                                         break;
+     default:  unknownCommands++;                      break;
+    }
+  } else if(a == ASCII_DC2) {
+    switch(b) {
+     case '*':
+      endLine(now);
+      rasterRows  = cmd[2];
+      rasterWidth = cmd[3];
+      if(!rasterWidth) rasterRows = 0;
+      break;
+     case 'T': // Self test: timing only, nothing drawn
+      busyUntil = now + dotPrintTime * 24 * 26 + dotFeedTime * (6 * 26 + 30);
+      break;
+     case '#': break;
+     default:  unknownCommands++; break;
+    }
+  } else if(a != ASCII_DLE) {
+    unknownCommands++;
+  }
+  cmd.clear();
+}
+
+// Adds a character cell to the current line, printing the line first
+// if there's no room left for it.
+void Thermal_Emulator::glyph(uint8_t c, uint64_t now) {
+  Glyph g;
+  g.width  = ((sizeMode >> 4) & 0x07) + 1;
+  g.height = ( sizeMode       & 0x07) + 1;
+  g.style = printMode & (BOLD_MASK | STRIKE_MASK | INVERSE_MASK);
+  if(inverse)        g.style |= INVERSE_MASK;
+  if(underline == 1) g.style |= UNDERLINE_1;
+  if(underline == 2) g.style |= UNDERLINE_1 | UNDERLINE_2;
+  if(c == ' ')       g.style |= BLANK_CELL;
+
+  int w = cellWidth * g.width + charSpacing;
+  if(lineWidth + w > paperDots) endLine(now);
+  line.push_back(g);
+  lineWidth += w;
+}
+
+// Prints the collected line (or feeds one blank line if there is none)
+// and keeps the mechanism busy for as long as that takes.
+void Thermal_Emulator::printLine(uint64_t now) {
+  int height = cellHeight * ((sizeMode & 0x07) + 1);
+  for(size_t i=0; i<line.size(); i++) {
+    if(line[i].height * cellHeight > height)
+      height = line[i].height * cellHeight;
+  }
+  int spacing = (lineHeight > cellHeight) ? lineHeight - cellHeight : 0;
+
+  if(line.empty()) {
+    feedDots(height + spacing, now);
+    return;
+  }
+  if(!firstDot) firstDot = now;
+
+  size_t top = dots.size();
+  dots.resize(top + height * rowBytes, 0);
+  int x = (justify == 1) ? (paperDots - lineWidth) / 2 :
+          (justify == 2) ? (paperDots - lineWidth)     : 0;
+  if(x < 0) x = 0;
+
+  for(size_t i=0; i<line.size(); i++) {
+    const Glyph &g = line[i];
+    int w  = cellWidth  * g.width;
+    int h  = cellHeight * g.height;
+    int in = (g.style & BOLD_MASK) ? 1 : 2; // Bold draws fatter cells
+    for(int yy=0; yy<h; yy++) {
+      int y = height - h + yy;              // Cells sit on the baseline
+      for(int xx=0; xx<w; xx++) {
+        int  px  = x + xx;
+        bool ink = !(g.style & BLANK_CELL) &&
+          (xx >= in * g.width) && (xx < w - in * g.width) &&
+          (yy >= 3 * g.height) && (yy < h - 3 * g.height);
+        if((g.style & STRIKE_MASK) && (yy == h / 2)) ink = true;
+        if((g.style & UNDERLINE_1) && (yy == h - 1)) ink = true;
+        if((g.style & UNDERLINE_2) && (yy == h - 2)) ink = true;
+        if(g.style & INVERSE_MASK) ink = !ink;
+        if(ink && (px < paperDots))
+          dots[top + y * rowBytes + px / 8] |= 0x80 >> (px & 7);
+      }
+    }
+    x += w + charSpacing;
+  }
+  line.clear();
+  lineWidth = 0;
+
+  busyUntil = now + height * dotPrintTime;
+  feedDots(spacing, busyUntil);
+}
+
+// Draws the barcode in 'cmd' (GS k, either form).  The bars aren't the
+// real symbology, just each data byte's bits at the module width, but
+// the size and the time taken are realistic.
+void Thermal_Emulator::barcode(uint64_t now) {
+  endLine(now);
+  bool   counted = cmd[2] >= 65;
+  size_t first   = counted ? 4 : 3;
+  size_t last    = counted ? cmd.size() : cmd.size() - 1; // Drop NUL
+  int    module  = (barWidth < 1) ? 1 : barWidth;
+  size_t top     = dots.size();
+
+  if(!firstDot) firstDot = now;
+  dots.resize(top + barHeight * rowBytes, 0);
+  int x = 10 * module;                          // Quiet zone
+  for(size_t i=first; i<last; i++) {
+    for(int b=7; b>=0; b--, x+=module) {
+      if(!((cmd[i] >> b) & 1)) continue;
+      for(int xx=x; (xx < x + module) && (xx < paperDots); xx++)
+        for(int y=0; y<barHeight; y++)
+          dots[top + y * rowBytes + xx / 8] |= 0x80 >> (xx & 7);
+    }
+  }
+  busyUntil = now + barHeight * dotPrintTime;
+
+  if(barLabel & 2) {                            // Text below
+    for(size_t i=first; i<last; i++) glyph(cmd[i], now);
+    printLine(busyUntil);
+  }
+}
+
+// Prints whatever text is waiting, as commands that move the paper do
+// first; unlike LF, does nothing when there's none.
+void Thermal_Emulator::endLine(uint64_t now) {
+  if(!line.empty()) printLine(now);
+}
+
+// Advances the paper n blank dot rows, after anything already underway.
+void Thermal_Emulator::feedDots(int n, uint64_t now) {
+  if(busyUntil < now) busyUntil = now;
+  if(n <= 0) return;
+  dots.resize(dots.size() + n * rowBytes, 0);
+  busyUntil += n * dotFeedTime;
+}
+
+// Prints one raster row; its time depends on how many heating passes
+// its black dots need.
+void Thermal_Emulator::rasterRow(const uint8_t *row, uint64_t now) {
+  unsigned long black = 0;
+  for(int i=0; i<rowBytes; i++) black += __builtin_popcount(row[i]);
+  unsigned long group  = (heatDots + 1) * 8;
+  unsigned long passes = (black + group - 1) / group;
+  if(!firstDot) firstDot = now;
+  dots.insert(dots.end(), row, row + rowBytes);
+  busyUntil = now + dotFeedTime + passes * rowPassTime;
+}
+
+// Writes the paper as a binary PBM (P4), as wide as the print head.
+bool Thermal_Emulator::savePBM(const char *path) {
+  FILE *f = fopen(path, "wb");
+  if(!f) return false;
+  fprintf(f, "P4\n%d %d\n", paperDots, rows());
+  bool ok = !dots.size() || (fwrite(&dots[0], 1, dots.size(), f) == dots.size());
+  return (fclose(f) == 0) && ok;
+}
+
+// ----------------------------------------------------------------------
+
+Thermal_EmulatorTransport::Thermal_EmulatorTransport(
+  Thermal_Emulator &emulator, Thermal_SimClock &clock) :
+  emulator(emulator), clock(clock) {
+  lineFree  = 0;
+  bitTime10 = 0;
+  flowMode  = 0;
+}
+
+bool Thermal_EmulatorTransport::begin(uint32_t baud) {
+  setBaudRate(baud);
+  return true;
+}
+
+// 8N1 framing: start bit, eight data bits, stop bit.
+void Thermal_EmulatorTransport::setBaudRate(uint32_t baud) {
+  bitTime10 = baud ? (10000000L + baud / 2) / baud : 0;
+}
+
+bool Thermal_EmulatorTransport::setFlowControl(uint8_t mode, uint8_t pin) {
+  (void)pin;
+  flowMode = mode;
+  return true;
+}
+
+// Each byte goes on the wire once the previous one is through, and
+// lands in the emulator when its stop bit does.
+void Thermal_EmulatorTransport::write(const uint8_t *buf, size_t len) {
+  for(size_t i=0; i<len; i++) {
+    if(lineFree < clock.time()) lineFree = clock.time();
+    lineFree += bitTime10;
+    emulator.receive(buf[i], lineFree);
+  }
+}
+
+size_t Thermal_EmulatorTransport::writable() {
+  return 4096;
+}
+
+int Thermal_EmulatorTransport::read() {
+  emulator.advance(clock.time());
+  return emulator.read();
+}
+
+bool Thermal_EmulatorTransport::busy() {
+  emulator.advance(clock.time());
+  return flowMode && emulator.busy();
+}
@@ -0,0 +1,174 @@
+/*------------------------------------------------------------------------
+  Virtual thermal printer for testing the Thermal_Print library on a
+  host, without a physical printer.
+
+  Thermal_Emulator consumes the byte stream Thermal_Print emits, draws
+  what a real printer would onto a strip of virtual paper as wide as
+  the profile's print head (384 dots for the 58 mm printers)
+  (text as solid character cells, bitmaps exactly), and models the
+  printer's small receive buffer and its print/feed mechanism so that
+  pacing that's too aggressive shows up as buffer overruns.
+
+  Thermal_SimClock and Thermal_EmulatorTransport plug it into
+  Thermal_Print: time only passes when the library waits, so a job that
+  would take minutes on paper runs in milliseconds.
+
+  Host builds only (uses the C++ standard library).
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Emulator_H
+#define Thermal_Emulator_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include "Thermal_Transport.h"
+#include "Thermal_Profile.h"
+
+class Thermal_Emulator {
+
+ public:
+
+  Thermal_Emulator(const Thermal_Profile *profile=&Thermal_Profile58mm,
+    size_t bufferSize=256);
+
+  void
+    setTimes(unsigned long dotPrint, unsigned long dotFeed),
+    receive(uint8_t c, uint64_t t),  // Byte fully arrived at time t (us)
+    advance(uint64_t t),             // Run the mechanism up to time t
+    reset();                         // Blank paper, power-on state
+  bool
+    busy(),                          // Buffer nearly full (DTR output)
+    savePBM(const char *path);       // Write the paper out as an image
+  int
+    read();                          // Next status reply byte, or -1
+  uint64_t
+    idleTime();                      // When everything received is done
+  const std::vector<uint8_t>
+    &paper() { return dots; }        // width() / 8 bytes a row, 1 = black
+  int
+    width() { return paperDots; }    // Dots across the paper
+  int
+    rows() { return dots.size() / rowBytes; }
+
+  // Statistics since the last reset()
+  unsigned long
+    bytesReceived,
+    overruns,                        // Bytes dropped, buffer was full
+    unknownCommands;
+  size_t
+    peakOccupancy;                   // Most bytes ever waiting in buffer
+  uint64_t
+    firstOverrun,                    // Time of the first dropped byte
+    firstDot;                        // When printing began, 0 = not yet
+
+ private:
+
+  struct Pending {                   // Byte waiting in the receive buffer
+    uint8_t  c;
+    uint64_t t;
+  };
+  struct Glyph {                     // Character waiting to be printed
+    uint8_t width, height, style;
+  };
+
+  std::deque<Pending>
+    rx;
+  std::deque<uint8_t>
+    replies;
+  std::vector<uint8_t>
+    dots,
+    cmd,                             // Command being collected
+    raster;                          // Raster row being printed
+  std::vector<Glyph>
+    line;
+  const Thermal_Profile
+    *profile;
+  size_t
+    bufferSize;
+  uint64_t
+    busyUntil;                       // Mechanism free at this time
+  unsigned long
+    dotPrintTime,
+    dotFeedTime,
+    rowPassTime;
+  uint8_t
+    printMode, sizeMode, justify, lineHeight, underline, inverse,
+    charSpacing, heatDots, rasterWidth, rtState,
+    barHeight, barWidth, barLabel;   // GS h, GS w, GS H
+  int
+    paperDots, rowBytes,             // From the profile
+    cellWidth, cellHeight,
+    rasterRows,                      // Raster rows still to come
+    lineWidth;                       // Dots used by 'line'
+
+  void
+    powerOn(),
+    execute(uint8_t c, uint64_t now),
+    command(uint64_t now),
+    printLine(uint64_t now),
+    endLine(uint64_t now),
+    feedDots(int n, uint64_t now),
+    rasterRow(const uint8_t *row, uint64_t now),
+    barcode(uint64_t now),
+    glyph(uint8_t c, uint64_t now);
+  size_t
+    commandLength();
+};
+
+// Clock that only moves when someone sleeps (or advances it).
+class Thermal_SimClock : public Thermal_Clock {
+
+ public:
+
+  Thermal_SimClock() { now = 0; }
+
+  uint32_t micros() { return (uint32_t)now; }
+  void     sleepMicros(uint32_t us) { now += us; }
+  void     advance(uint64_t us) { now += us; }
+  uint64_t time() { return now; }
+
+ private:
+
+  uint64_t now;
+};
+
+// Serial line into an emulator: bytes arrive at 10 bits per baud each.
+class Thermal_EmulatorTransport : public Thermal_Transport {
+
+ public:
+
+  Thermal_EmulatorTransport(Thermal_Emulator &emulator,
+    Thermal_SimClock &clock);
+
+  bool
+    begin(uint32_t baud),
+    setFlowControl(uint8_t mode, uint8_t pin),
+    busy();
+  void
+    setBaudRate(uint32_t baud),
+    write(const uint8_t *buf, size_t len);
+  size_t
+    writable();
+  int
+    read();
+  uint64_t
+    lineIdle() { return lineFree; }  // When the last byte finishes arriving
+
+ private:
+
+  Thermal_Emulator
+    &emulator;
+  Thermal_SimClock
+    &clock;
+  uint64_t
+    lineFree;                        // Wire is busy until this time
+  uint32_t
+    bitTime10;                       // Time for one byte on the wire, us
+  uint8_t
+    flowMode;
+};
+
+#endif // Thermal_Emulator_H
@@ -0,0 +1,57 @@
+/*------------------------------------------------------------------------
+  Dry-run job cost estimates for the Thermal_Print library; see
+  Thermal_Estimate.h.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include "Thermal_Estimate.h"
+
+Thermal_Estimator::Thermal_Estimator() : print(&counter, &timer) {
+  counter.owner = this;
+  timer.owner   = this;
+  timer.now     = 0;
+  elapsed       = lineFree = mechFree = 0;
+  bytes         = waiting = peak = 0;
+}
+
+// Each byte lands once the line's free and it's been shifted out.  If
+// the mechanism's free by then it has taken everything before it.
+void Thermal_Estimator::Counter::write(const uint8_t *, size_t len) {
+  uint32_t byteTime = owner->print.getByteTime();
+  owner->bytes += len;
+  while(len--) {
+    if(owner->lineFree < owner->elapsed) owner->lineFree = owner->elapsed;
+    owner->lineFree += byteTime;
+    if(owner->lineFree >= owner->mechFree) owner->waiting = 0;
+    if(++owner->waiting > owner->peak) owner->peak = owner->waiting;
+  }
+}
+
+// The printer's busy until the library's done waiting for it.  Bytes
+// sent before the wait have already landed (above), so this only holds
+// up the ones sent after it.
+void Thermal_Estimator::Timer::sleepMicros(uint32_t us) {
+  now            += us;
+  owner->elapsed += us;
+  owner->mechFree = owner->elapsed;
+}
+
+// Waits out whatever the last job left the printer doing, forgets its
+// settings and zeroes the counts.
+void Thermal_Estimator::start() {
+  print.drain();
+  print.invalidateState();
+  elapsed = lineFree = mechFree = 0;
+  bytes   = waiting = peak = 0;
+}
+
+void Thermal_Estimator::finish(Thermal_Cost *cost) {
+  print.drain();
+  cost->bytes         = bytes;
+  cost->totalTime     = elapsed;
+  cost->sendTime      = (uint64_t)bytes * print.getByteTime();
+  if(cost->sendTime > elapsed) cost->sendTime = elapsed;
+  cost->printTime     = elapsed - cost->sendTime;
+  cost->peakOccupancy = peak;
+}
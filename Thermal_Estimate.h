@@ -0,0 +1,102 @@
+/*------------------------------------------------------------------------
+  Dry-run job cost estimates for the Thermal_Print library.
+
+  Thermal_Print already works out how long everything it sends will
+  take the printer (that's how it paces its output), but only ever
+  uses the figures to wait.  A Thermal_Estimator has its own printer,
+  with a transport that just counts bytes and a clock that only moves
+  when the printer waits, so a job printed into it goes through exactly
+  the encoding and pacing of the real thing without any output or any
+  real waiting, and comes back as a Thermal_Cost:
+
+    Thermal_Estimator est;
+    est.printer().setTimes(...);   // As the printer being estimated for
+    est.start();
+    est.printer().println("2 x Soup");
+    Thermal_Cost cost;
+    est.finish(&cost);             // cost.totalTime: us until done
+
+  A short receipt costs a few microseconds to estimate, so a dispatcher
+  can price each ticket on every printer and send it to whichever would
+  finish it first (its current backlog plus totalTime).  Give the
+  estimator's printer the same profile, baud rate and setTimes() as the
+  printer it stands in for; like Thermal_TemplateBuilder, it needs no
+  begin().  Each start() forgets the printer's settings, so a job is
+  priced with every command it may need.
+
+  The buffer is modelled the way Thermal_Emulator does it: each byte
+  lands a byte time after the one before it (or after it was sent, if
+  the line was idle), and waits there while the mechanism is busy.  The
+  printer's own pacing says when that is: the library waits between
+  sending a burst and the next one for as long as it reckons the
+  printer needs, so the mechanism is taken to be busy from the last
+  byte of a burst landing until the end of that wait.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Estimate_H
+#define Thermal_Estimate_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Thermal_Print.h"
+
+struct Thermal_Cost {
+  uint32_t bytes;           // Sent to the printer
+  uint64_t sendTime;        // Of totalTime, us putting them on the wire
+  uint64_t printTime;       // Of totalTime, us printing and feeding
+  uint64_t totalTime;       // us from start() until the printer is idle
+  uint32_t peakOccupancy;   // Most bytes ever waiting in its buffer
+};
+
+class Thermal_Estimator {
+
+ public:
+
+  Thermal_Estimator();
+
+  Thermal_Print
+    &printer() { return print; }    // Print the job into this
+  void
+    start(),                        // Begin a new job
+    finish(Thermal_Cost *cost);     // Wait out its end; what it cost
+
+ private:
+
+  // Counts what the printer sends...
+  class Counter : public Thermal_Transport {
+   public:
+    Thermal_Estimator *owner;
+    bool   begin(uint32_t) { return true; }
+    void   setBaudRate(uint32_t) {}
+    void   write(const uint8_t *buf, size_t len);
+    size_t writable() { return (size_t)-1; }
+    int    read() { return -1; }
+  };
+  // ...and adds up its waits, without really waiting.
+  class Timer : public Thermal_Clock {
+   public:
+    Thermal_Estimator *owner;
+    uint32_t now;
+    uint32_t micros() { return now; }
+    void     sleepMicros(uint32_t us);
+  };
+
+  Counter
+    counter;
+  Timer
+    timer;
+  Thermal_Print
+    print;
+  uint64_t
+    elapsed,       // us waited since start()
+    lineFree,      // When the last byte sent lands, us after start()
+    mechFree;      // When the printer's done with what it has landed
+  uint32_t
+    bytes,         // Sent since start()
+    waiting,       // Landed but not yet taken by the mechanism
+    peak;          // Most ever waiting
+};
+
+#endif // Thermal_Estimate_H
@@ -0,0 +1,302 @@
+/*------------------------------------------------------------------------
+  Event-driven driver for many printers on a Linux host; see
+  Thermal_Fleet.h.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "Thermal_Fleet.h"
+
+static uint64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+Thermal_Fleet::Thermal_Fleet(int threads) : stopping(false) {
+  started = false;
+  if(threads < 1) threads = 1;
+  for(int i=0; i<threads; i++) {
+    Loop *l       = new Loop;
+    l->clock.loop = l;
+    l->epoll      = epoll_create1(EPOLL_CLOEXEC);
+    l->wake       = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    l->current    = NULL;
+    memset(&l->stats, 0, sizeof(l->stats));
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL;            // NULL marks the wake eventfd
+    epoll_ctl(l->epoll, EPOLL_CTL_ADD, l->wake, &ev);
+    loops.push_back(l);
+  }
+}
+
+Thermal_Fleet::~Thermal_Fleet() {
+  stop();
+  for(size_t i=0; i<slots.size(); i++) {
+    close(slots[i]->timer);
+    delete slots[i]->printer;
+    delete slots[i]->port;
+    delete slots[i];
+  }
+  for(size_t i=0; i<loops.size(); i++) {
+    close(loops[i]->epoll);
+    close(loops[i]->wake);
+    delete loops[i];
+  }
+}
+
+// Adds a printer on a serial device, or on a tty already open, spread
+// across the threads in turn.  Returns the printer, owned by the fleet,
+// or NULL once started.
+Thermal_Print *Thermal_Fleet::add(const char *device, uint32_t baud) {
+  return add(new Thermal_LinuxSerial(device), baud);
+}
+
+Thermal_Print *Thermal_Fleet::add(int fd, uint32_t baud) {
+  return add(new Thermal_LinuxSerial(fd), baud);
+}
+
+Thermal_Print *Thermal_Fleet::add(Thermal_LinuxSerial *port, uint32_t baud) {
+  if(started) {
+    delete port;
+    return NULL;
+  }
+  Slot *s     = new Slot;
+  s->loop     = loops[slots.size() % loops.size()];
+  s->port     = port;
+  s->printer  = new Thermal_Print(port, &s->loop->clock);
+  s->baud     = baud;
+  s->timer    = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  s->deadline = 0;
+  s->armed    = false;
+  struct epoll_event ev;
+  ev.events   = EPOLLIN;
+  ev.data.ptr = s;
+  epoll_ctl(s->loop->epoll, EPOLL_CTL_ADD, s->timer, &ev);
+  s->loop->slots.push_back(s);
+  slots.push_back(s);
+  return s->printer;
+}
+
+// Runs begin() on every printer, all at once since each waits out the
+// printer's boot time, then switches them to queued output and starts
+// the threads.  Returns false if it was already started.
+bool Thermal_Fleet::start() {
+  if(started) return false;
+  std::vector<std::thread> setup;
+  for(size_t i=0; i<slots.size(); i++) {
+    Slot *s = slots[i];
+    setup.push_back(std::thread([s]() {
+      s->printer->begin(120, s->baud);
+      s->printer->setAsync();
+    }));
+  }
+  for(size_t i=0; i<setup.size(); i++) setup[i].join();
+  started = true;
+  stopping.store(false);
+  for(size_t i=0; i<loops.size(); i++) {
+    Loop *l   = loops[i];
+    l->thread = std::thread(&Thermal_Fleet::run, this, l);
+  }
+  return true;
+}
+
+Thermal_Fleet::Slot *Thermal_Fleet::find(Thermal_Print *p) {
+  for(size_t i=0; i<slots.size(); i++) {
+    if(slots[i]->printer == p) return slots[i];
+  }
+  return NULL;
+}
+
+// Queues a job for printer 'p', to run on its thread after any already
+// queued for it.  Safe from any thread.
+bool Thermal_Fleet::submit(Thermal_Print *p, Thermal_JobStep step,
+  void *ctx) {
+  Slot *s = find(p);
+  if(!s) return false;
+  Inbound in = { s, { step, ctx } };
+  {
+    std::lock_guard<std::mutex> guard(s->loop->lock);
+    s->loop->inbox.push_back(in);
+  }
+  uint64_t one = 1;
+  return write(s->loop->wake, &one, sizeof(one)) == sizeof(one);
+}
+
+// Lets every job finish and every queue empty, then ends the threads.
+void Thermal_Fleet::stop() {
+  if(!started) return;
+  stopping.store(true);
+  for(size_t i=0; i<loops.size(); i++) {
+    uint64_t one = 1;
+    if(write(loops[i]->wake, &one, sizeof(one)) < 0) continue;
+  }
+  for(size_t i=0; i<loops.size(); i++) {
+    if(loops[i]->thread.joinable()) loops[i]->thread.join();
+  }
+  started = false;
+}
+
+// Totals over all threads; call after stop().
+void Thermal_Fleet::getStats(Thermal_FleetStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  for(size_t i=0; i<loops.size(); i++) {
+    Thermal_FleetStats *l = &loops[i]->stats;
+    stats->wakeups   += l->wakeups;
+    stats->lateTotal += l->lateTotal;
+    stats->cpuNanos  += l->cpuNanos;
+    if(l->lateMax > stats->lateMax) stats->lateMax = l->lateMax;
+    for(int b=0; b<THERMAL_FLEET_BUCKETS; b++) stats->late[b] += l->late[b];
+  }
+}
+
+// ----------------------------------------------------------------------
+// Fleet threads
+
+uint32_t Thermal_Fleet::Clock::micros() {
+  return (uint32_t)(nowNanos() / 1000);
+}
+
+// begin() sleeps on its own setup thread.  On the loop thread, a job
+// step that fills its printer's TX queue waits here for room, and no
+// timer on the thread can fire while it's busy.  So the wait handles
+// each printer's timer itself as it comes due, and returns once its own
+// printer's has been handled.
+void Thermal_Fleet::Clock::sleepMicros(uint32_t us) {
+  Slot    *s     = loop->current;
+  uint64_t until = nowNanos() + (uint64_t)us * 1000;
+  for(;;) {
+    Slot           *due  = NULL;
+    uint64_t        when = until;
+    struct timespec ts;
+    for(size_t i=0; s && (i<loop->slots.size()); i++) {
+      Slot *o = loop->slots[i];
+      if(o->armed && (o->deadline <= when)) {
+        due  = o;
+        when = o->deadline;
+      }
+    }
+    ts.tv_sec  = when / 1000000000ULL;
+    ts.tv_nsec = when % 1000000000ULL;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    if(!due) return;
+    expire(due);
+    if(due == s) return;
+  }
+}
+
+bool Thermal_Fleet::Clock::startTimer(Thermal_Print *p, uint32_t us) {
+  for(size_t i=0; i<loop->slots.size(); i++) {
+    Slot *s = loop->slots[i];
+    if(s->printer != p) continue;
+    struct itimerspec t;
+    memset(&t, 0, sizeof(t));
+    t.it_value.tv_sec  = us / 1000000;
+    t.it_value.tv_nsec = (us % 1000000) * 1000L + 1; // 0 would disarm
+    timerfd_settime(s->timer, 0, &t, NULL);
+    s->deadline = nowNanos() + (uint64_t)us * 1000;
+    s->armed    = true;
+    return true;
+  }
+  return false;
+}
+
+void Thermal_Fleet::arm(Slot *s, uint32_t us) {
+  s->loop->clock.startTimer(s->printer, us);
+}
+
+// The printer's timer is due: records how late, sends what's due and
+// sets the timer for the next entry.
+void Thermal_Fleet::expire(Slot *s) {
+  Thermal_FleetStats *st   = &s->loop->stats;
+  uint64_t            now  = nowNanos();
+  uint32_t            late = (now > s->deadline) ?
+                               (now - s->deadline) / 1000 : 0;
+  int                 b    = 0;
+  while((b < THERMAL_FLEET_BUCKETS - 1) && (late >> b)) b++;
+  st->wakeups++;
+  st->late[b]++;
+  st->lateTotal += late;
+  if(late > st->lateMax) st->lateMax = late;
+  s->armed = false;
+  uint32_t next = s->printer->service();
+  if(next) arm(s, next);
+}
+
+// Runs the printer's jobs while its queue has room.
+void Thermal_Fleet::steps(Slot *s) {
+  s->loop->current = s;
+  while(!s->jobs.empty() && !s->printer->readyIn()) {
+    Job &job = s->jobs.front();
+    if(!job.step(s->printer, job.ctx)) s->jobs.pop_front();
+  }
+  s->loop->current = NULL;
+}
+
+// One thread's event loop: timer expirations run the printer's service()
+// and record how late they came; the eventfd brings in new jobs.  Ends
+// once stop() has been called and its printers have nothing left.
+void Thermal_Fleet::run(Loop *l) {
+  struct epoll_event ev[32];
+  uint64_t           count;
+
+  for(;;) {
+    int n = epoll_wait(l->epoll, ev, 32, -1);
+    if((n < 0) && (errno != EINTR)) break;
+    for(int i=0; i<n; i++) {
+      Slot *s = (Slot *)ev[i].data.ptr;
+      if(!s) {
+        if(read(l->wake, &count, sizeof(count)) < 0) continue;
+        std::vector<Inbound> in;
+        {
+          std::lock_guard<std::mutex> guard(l->lock);
+          in.swap(l->inbox);
+        }
+        for(size_t j=0; j<in.size(); j++) {
+          in[j].slot->jobs.push_back(in[j].job);
+          steps(in[j].slot);
+        }
+        continue;
+      }
+      if((read(s->timer, &count, sizeof(count)) < 0) || !s->armed) continue;
+      expire(s);
+      steps(s);
+    }
+    // A printer whose queue emptied while another's job step waited has
+    // no timer left to bring it back here for its next step.
+    for(bool again=true; again; ) {
+      again = false;
+      for(size_t i=0; i<l->slots.size(); i++) {
+        Slot *s = l->slots[i];
+        if(s->armed || s->jobs.empty()) continue;
+        steps(s);
+        again = true;
+      }
+    }
+
+    if(stopping.load()) {
+      bool done;
+      {
+        std::lock_guard<std::mutex> guard(l->lock);
+        done = l->inbox.empty();
+      }
+      for(size_t i=0; done && (i<l->slots.size()); i++) {
+        Slot *s = l->slots[i];
+        done = s->jobs.empty() && !s->printer->pending();
+      }
+      if(done) break;
+    }
+  }
+
+  struct timespec cpu;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  l->stats.cpuNanos = (uint64_t)cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+}
@@ -0,0 +1,143 @@
+/*------------------------------------------------------------------------
+  Event-driven driver for many printers on a Linux host, for the
+  Thermal_Print library.
+
+  Rather than a process per printer, each blocking in its own pacing
+  waits, one Thermal_Fleet thread paces them all: every printer runs
+  with queued output (Thermal_Print::setAsync()), and its TX timer is a
+  timerfd that the thread waits on with epoll alongside all the others.
+  The encoding and the pacing model are Thermal_Print's own; only the
+  waiting moves.  With more than one thread, printers are split between
+  them, each thread driving its share the same way.
+
+    Thermal_Fleet   fleet;
+    Thermal_Print  *kitchen = fleet.add("/dev/ttyUSB0");
+    Thermal_TextJob ticket  = { "2 x Soup\n1 x Salad\n" };
+    fleet.start();
+    fleet.submit(kitchen, Thermal_TextJob::step, &ticket); // Any thread
+    ...
+    fleet.stop();                  // Once everything submitted is sent
+
+  Jobs are Thermal_Scheduler job steps, run on the fleet's thread when
+  the printer's queue has room.  A step that queues more than the queue
+  holds (THERMAL_TX_QUEUE_SIZE entries) still works, sending the rest
+  at the printer's pace from within the step.  The thread's other
+  printers keep sending what they have queued meanwhile, but get no new
+  steps until it's done; steps of a few lines keep them all moving.
+  Don't call the printers' own methods from other threads once started.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Fleet_H
+#define Thermal_Fleet_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Thermal_Print.h"
+#include "Thermal_Linux.h"
+#include "Thermal_Scheduler.h"
+
+// Wakeups are counted by lateness: bucket i holds those under 2^i us.
+#define THERMAL_FLEET_BUCKETS 20
+
+struct Thermal_FleetStats {
+  unsigned long
+    wakeups,                        // Timer expirations handled
+    late[THERMAL_FLEET_BUCKETS];    // Of those, by lateness
+  uint64_t
+    lateTotal,                      // us past deadlines, summed
+    cpuNanos;                       // CPU time of the fleet's threads
+  uint32_t
+    lateMax;
+};
+
+class Thermal_Fleet {
+
+ public:
+
+  Thermal_Fleet(int threads=1);
+  ~Thermal_Fleet();
+
+  Thermal_Print
+    *add(const char *device, uint32_t baud=BAUD_RATE), // Before start()
+    *add(int fd, uint32_t baud=BAUD_RATE);   // Open tty; not closed
+  bool
+    start(),                        // begin() printers, start threads
+    submit(Thermal_Print *p, Thermal_JobStep step, void *ctx=NULL);
+  void
+    stop(),                         // Finish all jobs, end threads
+    getStats(Thermal_FleetStats *stats);
+
+ private:
+
+  struct Loop;
+
+  // Thermal_Print's TX timer, as a timerfd on its loop's epoll set.
+  class Clock : public Thermal_Clock {
+   public:
+    Loop    *loop;
+    uint32_t micros();
+    void     sleepMicros(uint32_t us);
+    bool     startTimer(Thermal_Print *p, uint32_t us);
+  };
+
+  struct Job {
+    Thermal_JobStep step;
+    void           *ctx;
+  };
+
+  struct Slot {
+    Thermal_LinuxSerial *port;
+    Thermal_Print       *printer;
+    Loop                *loop;
+    uint32_t             baud;
+    int                  timer;     // timerfd
+    uint64_t             deadline;  // When it should fire, ns
+    bool                 armed;
+    std::deque<Job>      jobs;      // Loop thread only
+  };
+
+  struct Inbound {
+    Slot *slot;
+    Job   job;
+  };
+
+  struct Loop {
+    Clock               clock;
+    int                 epoll,
+                        wake;       // eventfd: inbox or stop
+    Slot               *current;    // Whose job step is running
+    std::vector<Slot *> slots;
+    std::mutex          lock;       // Guards inbox
+    std::vector<Inbound> inbox;
+    std::thread         thread;
+    Thermal_FleetStats  stats;
+  };
+
+  std::vector<Loop *>
+    loops;
+  std::vector<Slot *>
+    slots;
+  std::atomic<bool>
+    stopping;
+  bool
+    started;
+
+  Thermal_Print
+    *add(Thermal_LinuxSerial *port, uint32_t baud);
+  Slot
+    *find(Thermal_Print *p);
+  void
+    run(Loop *l),
+    steps(Slot *s);
+  static void
+    arm(Slot *s, uint32_t us),
+    expire(Slot *s);
+};
+
+#endif // Thermal_Fleet_H
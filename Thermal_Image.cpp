@@ -0,0 +1,273 @@
+/*------------------------------------------------------------------------
+  Image preparation for the Thermal_Print library.
+  See Thermal_Image.h for an overview.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "Thermal_Image.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define THERMAL_HAVE_AVX2 // Built with target("avx2"), chosen at run time
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Each kernel packs one row: pixel x becomes a black dot if it is darker
+// than pattern[x & 31].  A flat pattern is a plain threshold, a repeating
+// Bayer row is an ordered dither.  The pattern is 32 bytes so that every
+// vector width can load it directly.
+typedef void (*PackRowKernel)(const uint8_t *px, int w,
+  const uint8_t *pattern, uint8_t *out);
+
+// 8x8 Bayer matrix (values 0-63)
+static const uint8_t bayer8[8][8] = {
+  {  0, 32,  8, 40,  2, 34, 10, 42 },
+  { 48, 16, 56, 24, 50, 18, 58, 26 },
+  { 12, 44,  4, 36, 14, 46,  6, 38 },
+  { 60, 28, 52, 20, 62, 30, 54, 22 },
+  {  3, 35, 11, 43,  1, 33,  9, 41 },
+  { 51, 19, 59, 27, 49, 17, 57, 25 },
+  { 15, 47,  7, 39, 13, 45,  5, 37 },
+  { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+// Packs pixels [x, w) one at a time; also finishes rows for the vector
+// kernels, which always stop on a byte boundary.
+static void packRowTail(const uint8_t *px, int x, int w,
+  const uint8_t *pattern, uint8_t *out) {
+  for(; x < w; x += 8) {
+    uint8_t b = 0;
+    for(int i = 0; (i < 8) && ((x + i) < w); i++) {
+      if(px[x + i] < pattern[(x + i) & 31]) b |= 0x80 >> i;
+    }
+    out[x >> 3] = b;
+  }
+}
+
+static void packRowScalar(const uint8_t *px, int w, const uint8_t *pattern,
+  uint8_t *out) {
+  packRowTail(px, 0, w, pattern, out);
+}
+
+#if defined(__SSE2__)
+// movemask puts the leftmost pixel in bit 0; the printer wants it in
+// bit 7, so each result byte is flipped through this table.
+// Built by the compiler, so it's ready (and read-only) before any
+// thread can use it.
+struct ReverseTable {
+  uint8_t r[256];
+};
+
+static constexpr ReverseTable buildReverse() {
+  ReverseTable t = {};
+  for(int i = 0; i < 256; i++) {
+    for(int b = 0; b < 8; b++) if(i & (1 << b)) t.r[i] |= 0x80 >> b;
+  }
+  return t;
+}
+
+static constexpr ReverseTable reverseTable = buildReverse();
+static constexpr const uint8_t *reverseBits = reverseTable.r;
+
+static void packRowSSE2(const uint8_t *px, int w, const uint8_t *pattern,
+  uint8_t *out) {
+  const __m128i bias = _mm_set1_epi8((char)0x80); // Unsigned compare via signed
+  int x;
+  for(x = 0; (x + 16) <= w; x += 16) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(px + x)), bias);
+    __m128i t = _mm_xor_si128(
+      _mm_loadu_si128((const __m128i *)(pattern + (x & 31))), bias);
+    int m = _mm_movemask_epi8(_mm_cmplt_epi8(v, t));
+    out[(x >> 3)    ] = reverseBits[m & 0xFF];
+    out[(x >> 3) + 1] = reverseBits[m >> 8];
+  }
+  packRowTail(px, x, w, pattern, out);
+}
+#endif
+
+#if defined(THERMAL_HAVE_AVX2)
+__attribute__((target("avx2")))
+static void packRowAVX2(const uint8_t *px, int w, const uint8_t *pattern,
+  uint8_t *out) {
+  const __m256i bias = _mm256_set1_epi8((char)0x80);
+  // Mirror each group of 8 bytes so movemask yields MSB-first bytes.
+  const __m256i mirror = _mm256_setr_epi8(
+    7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+    7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  const __m256i t = _mm256_xor_si256(
+    _mm256_loadu_si256((const __m256i *)pattern), bias);
+  int x;
+  for(x = 0; (x + 32) <= w; x += 32) {
+    __m256i v = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i *)(px + x)), bias);
+    __m256i m = _mm256_shuffle_epi8(_mm256_cmpgt_epi8(t, v), mirror);
+    uint32_t bits = (uint32_t)_mm256_movemask_epi8(m);
+    out[(x >> 3)    ] = bits;
+    out[(x >> 3) + 1] = bits >>  8;
+    out[(x >> 3) + 2] = bits >> 16;
+    out[(x >> 3) + 3] = bits >> 24;
+  }
+  packRowTail(px, x, w, pattern, out);
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void packRowNEON(const uint8_t *px, int w, const uint8_t *pattern,
+  uint8_t *out) {
+  static const uint8_t weights[16] = {
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+  const uint8x16_t weight = vld1q_u8(weights);
+  int x;
+  for(x = 0; (x + 16) <= w; x += 16) {
+    uint8x16_t m = vandq_u8(
+      vcltq_u8(vld1q_u8(px + x), vld1q_u8(pattern + (x & 31))), weight);
+    // Bits are disjoint, so three rounds of pairwise adds OR each half
+    // down to one byte.
+    uint8x8_t r = vpadd_u8(vget_low_u8(m), vget_high_u8(m));
+    r = vpadd_u8(r, r);
+    r = vpadd_u8(r, r);
+    out[(x >> 3)    ] = vget_lane_u8(r, 0);
+    out[(x >> 3) + 1] = vget_lane_u8(r, 1);
+  }
+  packRowTail(px, x, w, pattern, out);
+}
+#endif
+
+bool Thermal_ImageKernelAvailable(uint8_t kernel) {
+  switch(kernel) {
+   case THERMAL_KERNEL_AUTO:
+   case THERMAL_KERNEL_SCALAR:
+    return true;
+#if defined(__SSE2__)
+   case THERMAL_KERNEL_SSE2:
+    return true;
+#endif
+#if defined(THERMAL_HAVE_AVX2)
+   case THERMAL_KERNEL_AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+#if defined(__ARM_NEON)
+   case THERMAL_KERNEL_NEON:
+    return true;
+#endif
+  }
+  return false;
+}
+
+static PackRowKernel packRowKernel(uint8_t kernel) {
+  if(kernel == THERMAL_KERNEL_AUTO) {
+    if(Thermal_ImageKernelAvailable(THERMAL_KERNEL_AVX2)) {
+      kernel = THERMAL_KERNEL_AVX2;
+    } else if(Thermal_ImageKernelAvailable(THERMAL_KERNEL_SSE2)) {
+      kernel = THERMAL_KERNEL_SSE2;
+    } else if(Thermal_ImageKernelAvailable(THERMAL_KERNEL_NEON)) {
+      kernel = THERMAL_KERNEL_NEON;
+    }
+  }
+  if(!Thermal_ImageKernelAvailable(kernel)) return packRowScalar;
+  switch(kernel) {
+#if defined(__SSE2__)
+   case THERMAL_KERNEL_SSE2: return packRowSSE2;
+#endif
+#if defined(THERMAL_HAVE_AVX2)
+   case THERMAL_KERNEL_AVX2: return packRowAVX2;
+#endif
+#if defined(__ARM_NEON)
+   case THERMAL_KERNEL_NEON: return packRowNEON;
+#endif
+  }
+  return packRowScalar;
+}
+
+int Thermal_ImageScaledHeight(int srcW, int srcH, int dstW) {
+  if(srcW < 1) return 0;
+  int h = (int)(((long)srcH * dstW + (srcW / 2)) / srcW);
+  return (h < 1) ? 1 : h;
+}
+
+void Thermal_ImageResize(const uint8_t *src, int srcW, int srcH,
+  int srcStride, uint8_t *dst, int dstW, int dstH) {
+  for(int dy = 0; dy < dstH; dy++) {
+    int y0 = (int)((long)dy * srcH / dstH);
+    int y1 = (int)((long)(dy + 1) * srcH / dstH);
+    if(y1 <= y0) y1 = y0 + 1;
+    for(int dx = 0; dx < dstW; dx++) {
+      int x0 = (int)((long)dx * srcW / dstW);
+      int x1 = (int)((long)(dx + 1) * srcW / dstW);
+      if(x1 <= x0) x1 = x0 + 1;
+      unsigned long sum = 0;
+      for(int y = y0; y < y1; y++) {
+        const uint8_t *row = src + (size_t)y * srcStride;
+        for(int x = x0; x < x1; x++) sum += row[x];
+      }
+      unsigned long n = (unsigned long)(x1 - x0) * (y1 - y0);
+      dst[(size_t)dy * dstW + dx] = (sum + n / 2) / n;
+    }
+  }
+}
+
+// Floyd-Steinberg error diffusion, one row of error carried forward.
+static void ditherFloyd(const uint8_t *gray, int w, int h, int stride,
+  uint8_t *bits, uint8_t threshold) {
+  int      rowBytes = (w + 7) / 8;
+  int16_t *err      = (int16_t *)calloc(2 * (w + 2), sizeof(int16_t));
+  if(!err) return;
+  int16_t *cur = err + 1, *next = err + (w + 2) + 1;
+
+  for(int y = 0; y < h; y++) {
+    const uint8_t *px  = gray + (size_t)y * stride;
+    uint8_t       *out = bits + (size_t)y * rowBytes;
+    memset(out, 0, rowBytes);
+    memset(next - 1, 0, (w + 2) * sizeof(int16_t));
+    for(int x = 0; x < w; x++) {
+      int v = px[x] + cur[x], e;
+      if(v < threshold) {
+        out[x >> 3] |= 0x80 >> (x & 7);
+        e = v;
+      } else {
+        e = v - 255;
+      }
+      cur[x + 1]  += (e * 7) / 16;
+      next[x - 1] += (e * 3) / 16;
+      next[x]     += (e * 5) / 16;
+      next[x + 1] += e / 16;
+    }
+    int16_t *t = cur; cur = next; next = t;
+  }
+  free(err);
+}
+
+void Thermal_ImageDither(const uint8_t *gray, int w, int h, int stride,
+  uint8_t *bits, uint8_t method, uint8_t threshold, uint8_t kernel) {
+  if((w < 1) || (h < 1)) return;
+  if(method == THERMAL_DITHER_FLOYD) {
+    ditherFloyd(gray, w, h, stride, bits, threshold);
+    return;
+  }
+
+  PackRowKernel pack     = packRowKernel(kernel);
+  int           rowBytes = (w + 7) / 8;
+  uint8_t       pattern[32];
+
+  if(method != THERMAL_DITHER_BAYER) memset(pattern, threshold, sizeof(pattern));
+  for(int y = 0; y < h; y++) {
+    if(method == THERMAL_DITHER_BAYER) {
+      // Spread the 64 levels evenly around the threshold.
+      for(int x = 0; x < 32; x++) {
+        int t = threshold - 128 + bayer8[y & 7][x & 7] * 4 + 2;
+        pattern[x] = (t < 0) ? 0 : (t > 255) ? 255 : t;
+      }
+    }
+    pack(gray + (size_t)y * stride, w, pattern, bits + (size_t)y * rowBytes);
+  }
+}
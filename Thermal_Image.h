@@ -0,0 +1,56 @@
+/*------------------------------------------------------------------------
+  Image preparation for the Thermal_Print library.
+
+  Turns 8-bit grayscale images into the packed 1-bit-per-pixel rows that
+  Thermal_Print::printBitmap() expects: optional rescaling to the print
+  head width, then threshold, ordered (Bayer) or Floyd-Steinberg
+  dithering.  Threshold and ordered dithering use SSE2/AVX2/NEON kernels
+  where the target has them; every kernel produces exactly the same
+  output as the portable scalar one.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Image_H
+#define Thermal_Image_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Dithering methods for Thermal_ImageDither()
+#define THERMAL_DITHER_THRESHOLD 0 // Black wherever gray < threshold
+#define THERMAL_DITHER_BAYER     1 // 8x8 ordered dither
+#define THERMAL_DITHER_FLOYD     2 // Floyd-Steinberg error diffusion
+
+// Pixel kernels for Thermal_ImageDither()
+#define THERMAL_KERNEL_AUTO   0 // Fastest one available
+#define THERMAL_KERNEL_SCALAR 1
+#define THERMAL_KERNEL_SSE2   2
+#define THERMAL_KERNEL_AVX2   3
+#define THERMAL_KERNEL_NEON   4
+
+// Print head width, in dots
+#define THERMAL_IMAGE_WIDTH 384
+
+// Height an image of srcW x srcH must be scaled to at width dstW to
+// keep its aspect ratio.
+int Thermal_ImageScaledHeight(int srcW, int srcH, int dstW=THERMAL_IMAGE_WIDTH);
+
+// Rescales an 8-bit grayscale image.  Shrinking averages each block of
+// source pixels; enlarging repeats them (keeps logos and codes crisp).
+void Thermal_ImageResize(const uint8_t *src, int srcW, int srcH,
+  int srcStride, uint8_t *dst, int dstW, int dstH);
+
+// Converts 8-bit grayscale (0 = black) to 1bpp rows of (w + 7) / 8
+// bytes each, MSB leftmost, 1 = black dot.  'threshold' is the gray
+// level for THERMAL_DITHER_THRESHOLD and the midpoint for the others.
+// Floyd-Steinberg is inherently serial and always runs scalar.
+void Thermal_ImageDither(const uint8_t *gray, int w, int h, int stride,
+  uint8_t *bits, uint8_t method=THERMAL_DITHER_FLOYD,
+  uint8_t threshold=128, uint8_t kernel=THERMAL_KERNEL_AUTO);
+
+// True if the given kernel was compiled in and the CPU can run it.
+bool Thermal_ImageKernelAvailable(uint8_t kernel);
+
+#endif // Thermal_Image_H
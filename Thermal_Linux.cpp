@@ -0,0 +1,245 @@
+/*------------------------------------------------------------------------
+  Linux serial transport and clock for the Thermal_Print library.
+  See Thermal_Linux.h for an overview.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "Thermal_Print.h"
+#include "Thermal_Linux.h"
+
+Thermal_LinuxSerial::Thermal_LinuxSerial(const char *device) {
+  this->device = device;
+  fd           = -1;
+  ownFD        = true;
+  flowMode     = THERMAL_FLOW_NONE;
+}
+
+Thermal_LinuxSerial::Thermal_LinuxSerial(int fd) {
+  device       = NULL;
+  this->fd     = fd;
+  ownFD        = false;
+  flowMode     = THERMAL_FLOW_NONE;
+}
+
+Thermal_LinuxSerial::~Thermal_LinuxSerial() {
+  if(ownFD && (fd >= 0)) close(fd);
+}
+
+int Thermal_LinuxSerial::getFD() {
+  return fd;
+}
+
+// termios only takes its own speed constants.  Returns false for a
+// rate it has none for.
+static bool baudConstant(uint32_t baud, speed_t *speed) {
+  switch(baud) {
+   case   1200: *speed = B1200;   return true;
+   case   2400: *speed = B2400;   return true;
+   case   4800: *speed = B4800;   return true;
+   case   9600: *speed = B9600;   return true;
+   case  19200: *speed = B19200;  return true;
+   case  38400: *speed = B38400;  return true;
+   case  57600: *speed = B57600;  return true;
+   case 115200: *speed = B115200; return true;
+   case 230400: *speed = B230400; return true;
+  }
+  return false;
+}
+
+// Opens the device (unless given a descriptor) in raw, non-blocking mode.
+// Returns false if it can't be opened or the rate isn't supported.
+bool Thermal_LinuxSerial::begin(uint32_t baud) {
+  struct termios tio;
+  speed_t        speed;
+
+  if(!baudConstant(baud, &speed)) return false;
+  if(fd < 0) {
+    if(!device) return false;
+    fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(fd < 0) return false;
+  } else {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+  if(tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN]  = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return true;
+}
+
+// Leaves the speed alone for a rate supportsBaud() refuses.
+void Thermal_LinuxSerial::setBaudRate(uint32_t baud) {
+  struct termios tio;
+  speed_t        speed;
+  if(!baudConstant(baud, &speed)) return;
+  if((fd < 0) || (tcgetattr(fd, &tio) != 0)) return;
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  tcsetattr(fd, TCSADRAIN, &tio);
+}
+
+bool Thermal_LinuxSerial::supportsBaud(uint32_t baud) {
+  speed_t speed;
+  return baudConstant(baud, &speed);
+}
+
+// THERMAL_FLOW_CTS hands flow control to the serial driver (CRTSCTS).
+// THERMAL_FLOW_BUSY polls the CTS modem line instead; 'pin' is unused.
+// Either way the printer's busy output goes to the port's CTS input.
+bool Thermal_LinuxSerial::setFlowControl(uint8_t mode, uint8_t pin) {
+  struct termios tio;
+  (void)pin;
+  if((fd < 0) || (tcgetattr(fd, &tio) != 0)) return false;
+  if(mode == THERMAL_FLOW_CTS) tio.c_cflag |=  CRTSCTS;
+  else                         tio.c_cflag &= ~CRTSCTS;
+  tcsetattr(fd, TCSADRAIN, &tio);
+  flowMode = mode;
+  return true;
+}
+
+bool Thermal_LinuxSerial::busy() {
+  int lines;
+  if((flowMode != THERMAL_FLOW_BUSY) || (ioctl(fd, TIOCMGET, &lines) < 0))
+    return false;
+  return !(lines & TIOCM_CTS);
+}
+
+// Blocks until the descriptor can take more output.
+void Thermal_LinuxSerial::waitWritable() {
+  struct pollfd p = { fd, POLLOUT, 0 };
+  poll(&p, 1, -1);
+}
+
+void Thermal_LinuxSerial::write(const uint8_t *buf, size_t len) {
+  while(len && (fd >= 0)) {
+    ssize_t n = ::write(fd, buf, len);
+    if(n > 0) {
+      buf += n;
+      len -= n;
+    } else if((n < 0) && (errno == EAGAIN)) {
+      waitWritable();
+    } else if((n < 0) && (errno != EINTR)) {
+      return; // Port gone; nothing useful to do with the data
+    }
+  }
+}
+
+// Sends all the pieces with as few syscalls as the kernel allows.
+void Thermal_LinuxSerial::writev(const Thermal_IOVec *iov, int count) {
+  struct iovec v[16];
+  while((count > 0) && (fd >= 0)) {
+    int n = (count < 16) ? count : 16;
+    for(int i=0; i<n; i++) {
+      v[i].iov_base = (void *)iov[i].data;
+      v[i].iov_len  = iov[i].len;
+    }
+    int      first = 0;
+    ssize_t  sent;
+    while(first < n) {
+      sent = ::writev(fd, v + first, n - first);
+      if(sent < 0) {
+        if(errno == EAGAIN)      waitWritable();
+        else if(errno != EINTR)  return;
+        continue;
+      }
+      // Skip over whatever went out, possibly partway into a piece.
+      while((first < n) && (sent >= (ssize_t)v[first].iov_len)) {
+        sent -= v[first++].iov_len;
+      }
+      if(first < n) {
+        v[first].iov_base  = (uint8_t *)v[first].iov_base + sent;
+        v[first].iov_len  -= sent;
+      }
+    }
+    iov   += n;
+    count -= n;
+  }
+}
+
+// Waits until everything written has actually left the port.
+void Thermal_LinuxSerial::flush() {
+  if(fd >= 0) tcdrain(fd);
+}
+
+size_t Thermal_LinuxSerial::writable() {
+  struct pollfd p = { fd, POLLOUT, 0 };
+  return ((fd >= 0) && (poll(&p, 1, 0) == 1) && (p.revents & POLLOUT)) ?
+    4096 : 0;
+}
+
+int Thermal_LinuxSerial::read() {
+  uint8_t c;
+  return ((fd >= 0) && (::read(fd, &c, 1) == 1)) ? c : -1;
+}
+
+uint32_t Thermal_LinuxClock::micros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000);
+}
+
+void Thermal_LinuxClock::sleepMicros(uint32_t us) {
+  struct timespec ts;
+  ts.tv_sec  = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000L;
+  while((nanosleep(&ts, &ts) < 0) && (errno == EINTR));
+}
+
+Thermal_SpoolFile::Thermal_SpoolFile(const char *path, uint32_t size,
+  uint32_t sector) {
+  struct stat st;
+  bytes        = size;
+  this->sector = sector;
+  fd           = open(path, O_RDWR | O_CREAT, 0644);
+  if((fd >= 0) && (fstat(fd, &st) == 0) && (st.st_size < (off_t)size)) {
+    for(uint32_t at = st.st_size - st.st_size % sector; at < size; at += sector) {
+      if(!erase(at)) break;
+    }
+    sync();
+  }
+}
+
+Thermal_SpoolFile::~Thermal_SpoolFile() {
+  if(fd >= 0) close(fd);
+}
+
+bool Thermal_SpoolFile::read(uint32_t offset, uint8_t *buf, size_t len) {
+  return (fd >= 0) && (pread(fd, buf, len, offset) == (ssize_t)len);
+}
+
+bool Thermal_SpoolFile::program(uint32_t offset, const uint8_t *buf,
+  size_t len) {
+  return (fd >= 0) && (pwrite(fd, buf, len, offset) == (ssize_t)len);
+}
+
+bool Thermal_SpoolFile::erase(uint32_t offset) {
+  uint8_t blank[4096];
+  memset(blank, 0xFF, sizeof(blank));
+  for(uint32_t done = 0; done < sector; ) {
+    uint32_t n = sector - done;
+    if(n > sizeof(blank)) n = sizeof(blank);
+    if(!program(offset + done, blank, n)) return false;
+    done += n;
+  }
+  return true;
+}
+
+bool Thermal_SpoolFile::sync() {
+  return (fd >= 0) && (fdatasync(fd) == 0);
+}
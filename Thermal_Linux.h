@@ -0,0 +1,94 @@
+/*------------------------------------------------------------------------
+  Linux serial transport and clock for the Thermal_Print library.
+
+  Lets a Raspberry Pi, Jetson or other Linux host drive the printer
+  directly through a tty (e.g. /dev/serial0, /dev/ttyUSB0), with no
+  microcontroller in between.  Output goes to the kernel a whole paced
+  frame at a time rather than a syscall per byte.  Works on any open
+  descriptor too, such as one side of a pty pair.  Thermal_SpoolFile
+  keeps a Thermal_Spool log in a file.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Linux_H
+#define Thermal_Linux_H
+
+#include "Thermal_Transport.h"
+#include "Thermal_Spool.h"
+
+class Thermal_LinuxSerial : public Thermal_Transport {
+
+ public:
+
+  Thermal_LinuxSerial(const char *device);
+  Thermal_LinuxSerial(int fd);      // Already open; not closed by us
+  ~Thermal_LinuxSerial();
+
+  bool
+    begin(uint32_t baud),
+    setFlowControl(uint8_t mode, uint8_t pin),
+    busy(),
+    supportsBaud(uint32_t baud);
+  void
+    setBaudRate(uint32_t baud),
+    write(const uint8_t *buf, size_t len),
+    writev(const Thermal_IOVec *iov, int count),
+    flush();
+  size_t
+    writable();
+  int
+    read(),
+    getFD();
+
+ private:
+
+  const char
+    *device;
+  int
+    fd;
+  bool
+    ownFD;         // We opened fd, so we close it
+  uint8_t
+    flowMode;      // THERMAL_FLOW_* setting
+  void
+    waitWritable();
+};
+
+class Thermal_LinuxClock : public Thermal_Clock {
+
+ public:
+
+  uint32_t
+    micros();
+  void
+    sleepMicros(uint32_t us);
+};
+
+// Spool log in a file of 'size' bytes, created (erased) if need be.
+class Thermal_SpoolFile : public Thermal_SpoolStore {
+
+ public:
+
+  Thermal_SpoolFile(const char *path, uint32_t size=65536,
+    uint32_t sector=4096);
+  ~Thermal_SpoolFile();
+
+  uint32_t size() { return bytes; }
+  uint32_t sectorSize() { return sector; }
+  bool
+    read(uint32_t offset, uint8_t *buf, size_t len),
+    program(uint32_t offset, const uint8_t *buf, size_t len),
+    erase(uint32_t offset),
+    sync();
+
+ private:
+
+  int
+    fd;
+  uint32_t
+    bytes,
+    sector;
+};
+
+#endif // Thermal_Linux_H
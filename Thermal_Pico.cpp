@@ -0,0 +1,155 @@
+/*------------------------------------------------------------------------
+  Raspberry Pi Pico transport and clock for the Thermal_Print library.
+  See Thermal_Pico.h for an overview.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/flash.h"
+#include "Thermal_Print.h"
+#include "Thermal_Pico.h"
+
+Thermal_PicoUART::Thermal_PicoUART(uart_inst_t *uart, uint8_t txPin,
+  uint8_t rxPin) {
+  this->uart  = uart;
+  this->txPin = txPin;
+  this->rxPin = rxPin;
+  busyPin     = 0;
+  flowMode    = THERMAL_FLOW_NONE;
+}
+
+bool Thermal_PicoUART::begin(uint32_t baud) {
+  uart_init(uart, baud);
+  // Set the TX and RX pins by using the function select on the GPIO
+  // Set datasheet for more information on function select
+  gpio_set_function(txPin, GPIO_FUNC_UART);
+  gpio_set_function(rxPin, GPIO_FUNC_UART);
+  return true;
+}
+
+void Thermal_PicoUART::setBaudRate(uint32_t baud) {
+  uart_set_baudrate(uart, baud);
+}
+
+// THERMAL_FLOW_BUSY watches the printer's busy line on any GPIO;
+// THERMAL_FLOW_CTS needs it on this UART's CTS pin (GPIO 2 or 18 for
+// uart0, 6 or 22 for uart1) and lets the UART hold off by itself.
+bool Thermal_PicoUART::setFlowControl(uint8_t mode, uint8_t pin) {
+  if(flowMode == THERMAL_FLOW_CTS) uart_set_hw_flow(uart, false, false);
+  switch(mode) {
+   case THERMAL_FLOW_BUSY:
+    gpio_init(pin);
+    gpio_set_dir(pin, GPIO_IN);
+    gpio_pull_down(pin);           // Read as ready if not connected
+    break;
+   case THERMAL_FLOW_CTS:
+    gpio_set_function(pin, GPIO_FUNC_UART);
+    uart_set_hw_flow(uart, true, false);
+    break;
+  }
+  busyPin  = pin;
+  flowMode = mode;
+  return true;
+}
+
+bool Thermal_PicoUART::busy() {
+  return (flowMode == THERMAL_FLOW_BUSY) && gpio_get(busyPin); // High = busy
+}
+
+void Thermal_PicoUART::write(const uint8_t *buf, size_t len) {
+  uart_write_blocking(uart, buf, len);
+}
+
+// The SDK can only say whether the TX FIFO has room for one more.
+size_t Thermal_PicoUART::writable() {
+  return uart_is_writable(uart) ? 1 : 0;
+}
+
+int Thermal_PicoUART::read() {
+  return uart_is_readable(uart) ? (uint8_t)uart_getc(uart) : -1;
+}
+
+uint32_t Thermal_PicoClock::micros() {
+  return time_us_32();
+}
+
+void Thermal_PicoClock::sleepMicros(uint32_t us) {
+  sleep_us(us);
+}
+
+// Alarm handler: a negative return reschedules relative to now, 0 stops.
+static int64_t serviceAlarm(alarm_id_t id, void *user_data) {
+  uint32_t next = ((Thermal_Print *)user_data)->service();
+  return next ? -(int64_t)next : 0;
+}
+
+bool Thermal_PicoClock::startTimer(Thermal_Print *p, uint32_t us) {
+  return add_alarm_in_us(us, serviceAlarm, p, true) >= 0;
+}
+
+Thermal_SpoolFlash::Thermal_SpoolFlash(uint32_t offset, uint32_t size) {
+  start = offset;
+  bytes = size;
+}
+
+uint32_t Thermal_SpoolFlash::sectorSize() {
+  return FLASH_SECTOR_SIZE;
+}
+
+// Flash is memory-mapped for reading.
+bool Thermal_SpoolFlash::read(uint32_t offset, uint8_t *buf, size_t len) {
+  memcpy(buf, (const uint8_t *)(XIP_BASE + start + offset), len);
+  return true;
+}
+
+// How long to wait for the other core to pause before giving up (ms).
+#define FLASH_LOCKOUT_TIMEOUT 100
+
+struct FlashOp {
+  uint32_t       offset;
+  const uint8_t *data;
+};
+
+static void flashProgram(void *param) {
+  FlashOp *op = (FlashOp *)param;
+  flash_range_program(op->offset, op->data, FLASH_PAGE_SIZE);
+}
+
+static void flashErase(void *param) {
+  flash_range_erase(((FlashOp *)param)->offset, FLASH_SECTOR_SIZE);
+}
+
+// Flash is programmed a whole page at a time, but programming only
+// clears bits, so a page can be programmed again with its current
+// contents and the new bytes written over erased ones.  Appending a
+// small record costs a page program and no erase.
+bool Thermal_SpoolFlash::program(uint32_t offset, const uint8_t *buf,
+  size_t len) {
+  uint8_t page[FLASH_PAGE_SIZE];
+  while(len) {
+    uint32_t at   = start + offset;
+    uint32_t base = at - (at % FLASH_PAGE_SIZE);
+    size_t   n    = FLASH_PAGE_SIZE - (at - base);
+    if(n > len) n = len;
+    memcpy(page, (const uint8_t *)(XIP_BASE + base), FLASH_PAGE_SIZE);
+    memcpy(page + (at - base), buf, n);
+    FlashOp op = { base, page };
+    if(flash_safe_execute(flashProgram, &op, FLASH_LOCKOUT_TIMEOUT) !=
+      PICO_OK) return false;
+    offset += n;
+    buf    += n;
+    len    -= n;
+  }
+  return true;
+}
+
+bool Thermal_SpoolFlash::erase(uint32_t offset) {
+  FlashOp op = { start + offset, NULL };
+  return flash_safe_execute(flashErase, &op, FLASH_LOCKOUT_TIMEOUT) ==
+    PICO_OK;
+}
@@ -0,0 +1,88 @@
+/*------------------------------------------------------------------------
+  Raspberry Pi Pico transport and clock for the Thermal_Print library.
+
+  Thermal_PicoUART drives the printer from one of the RP2040's UARTs on
+  the given TX/RX pins; Thermal_PicoClock uses the microsecond timer and
+  its alarms, so queued output (Thermal_Print::setAsync()) drains from
+  a timer interrupt.  Thermal_SpoolFlash keeps a Thermal_Spool log in
+  a range of the board's flash.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Pico_H
+#define Thermal_Pico_H
+
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "Thermal_Transport.h"
+#include "Thermal_Spool.h"
+
+class Thermal_PicoUART : public Thermal_Transport {
+
+ public:
+
+  Thermal_PicoUART(uart_inst_t *uart=uart0, uint8_t txPin=0,
+    uint8_t rxPin=1);
+
+  bool
+    begin(uint32_t baud),
+    setFlowControl(uint8_t mode, uint8_t pin),
+    busy();
+  void
+    setBaudRate(uint32_t baud),
+    write(const uint8_t *buf, size_t len);
+  size_t
+    writable();
+  int
+    read();
+
+ private:
+
+  uart_inst_t
+    *uart;
+  uint8_t
+    txPin,
+    rxPin,
+    busyPin,       // GPIO watching the printer's busy line
+    flowMode;      // THERMAL_FLOW_* setting
+};
+
+class Thermal_PicoClock : public Thermal_Clock {
+
+ public:
+
+  uint32_t
+    micros();
+  void
+    sleepMicros(uint32_t us);
+  bool
+    startTimer(Thermal_Print *p, uint32_t us);
+};
+
+// Spool log in 'size' bytes of flash starting 'offset' bytes in, both
+// multiples of FLASH_SECTOR_SIZE and clear of the program (the end of
+// flash is usual).  Flash is written through flash_safe_execute(), which
+// also pauses the other core if it's running; that core must have called
+// flash_safe_execute_core_init() (Thermal_Pipeline's engine does).
+class Thermal_SpoolFlash : public Thermal_SpoolStore {
+
+ public:
+
+  Thermal_SpoolFlash(uint32_t offset, uint32_t size);
+
+  uint32_t size() { return bytes; }
+  uint32_t sectorSize();
+  bool
+    read(uint32_t offset, uint8_t *buf, size_t len),
+    program(uint32_t offset, const uint8_t *buf, size_t len),
+    erase(uint32_t offset);
+
+ private:
+
+  uint32_t
+    start,
+    bytes;
+};
+
+#endif // Thermal_Pico_H
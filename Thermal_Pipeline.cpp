@@ -0,0 +1,253 @@
+/*------------------------------------------------------------------------
+  Two-core print pipeline for the Thermal_Print library; see
+  Thermal_Pipeline.h.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include "Thermal_Pipeline.h"
+#ifdef THERMAL_PICO
+#include "pico/multicore.h"
+#include "pico/flash.h"
+#include "hardware/sync.h"
+#else
+#include <chrono>
+#endif
+
+// Each queue entry is a byte to send or one of these, with a 30-bit value.
+#define PIPE_KIND  0xC0000000
+#define PIPE_BYTE  0x00000000
+#define PIPE_DELAY 0x80000000 // Wait this many us after the last byte
+#define PIPE_MARK  0x40000000 // Next mark reached
+#define PIPE_BAUD  0xC0000000 // Change the transport's speed
+#define PIPE_VALUE 0x3FFFFFFF
+#define PIPE_MASK  (THERMAL_PIPELINE_SIZE - 1)
+
+Thermal_Pipeline::Thermal_Pipeline(Thermal_Transport *transport,
+  Thermal_Clock *clock) : head(0), tail(0), completed(0), stopping(false),
+  running(false) {
+  input.owner    = this;
+  timeline.owner = this;
+  timeline.now   = 0;
+  out            = transport;
+  outClock       = clock;
+  markCallback   = NULL;
+  markContext    = NULL;
+  marks          = marksSeen = 0;
+  due            = clock->micros();
+}
+
+Thermal_Pipeline::~Thermal_Pipeline() {
+  stop();
+}
+
+// ----------------------------------------------------------------------
+// Application side
+
+// Before launch() only, while the engine isn't using the port.
+bool Thermal_Pipeline::Input::begin(uint32_t baud) {
+  return owner->out->begin(baud);
+}
+
+// Takes effect in order with the output around it.
+void Thermal_Pipeline::Input::setBaudRate(uint32_t baud) {
+  owner->push(PIPE_BAUD | (baud & PIPE_VALUE));
+}
+
+// Only asks, without touching the port, so the real transport can
+// answer even while the engine is using it.
+bool Thermal_Pipeline::Input::supportsBaud(uint32_t baud) {
+  return owner->out->supportsBaud(baud);
+}
+
+void Thermal_Pipeline::Input::write(const uint8_t *buf, size_t len) {
+  while(len--) owner->push(PIPE_BYTE | *buf++);
+}
+
+void Thermal_Pipeline::Timeline::sleepMicros(uint32_t us) {
+  now += us;
+  while(us > PIPE_VALUE) {
+    owner->push(PIPE_DELAY | PIPE_VALUE);
+    us -= PIPE_VALUE;
+  }
+  if(us) owner->push(PIPE_DELAY | us);
+}
+
+// Appends one entry, waiting for room if the queue is full.  The entry
+// is written before head moves past it (release), so the engine never
+// sees a slot it can't read yet.
+void Thermal_Pipeline::push(uint32_t entry) {
+  uint32_t h = head.load(std::memory_order_relaxed);
+  while((h - tail.load(std::memory_order_acquire)) == THERMAL_PIPELINE_SIZE)
+    pause();
+  queue[h & PIPE_MASK] = entry;
+  head.store(h + 1, std::memory_order_release);
+  signal();
+}
+
+size_t Thermal_Pipeline::room() {
+  return THERMAL_PIPELINE_SIZE - (head.load(std::memory_order_relaxed) -
+    tail.load(std::memory_order_acquire));
+}
+
+// Returns an id that done() reports once the engine has sent everything
+// queued before it and waited out its delays.  Queued waits only cover
+// output up to the printer's last pacing point, so call drain() first
+// to include the time the printer takes to print it all.
+uint32_t Thermal_Pipeline::mark() {
+  push(PIPE_MARK);
+  return ++marks;
+}
+
+bool Thermal_Pipeline::done(uint32_t id) {
+  return (int32_t)(completed.load(std::memory_order_acquire) - id) >= 0;
+}
+
+void Thermal_Pipeline::wait(uint32_t id) {
+  while(!done(id)) pause();
+}
+
+// Set before launch().  The callback runs on the engine's core, so it
+// should be short and mustn't print.
+void Thermal_Pipeline::onMark(Thermal_MarkCallback callback, void *ctx) {
+  markCallback = callback;
+  markContext  = ctx;
+}
+
+// ----------------------------------------------------------------------
+// Engine side
+
+// Sends queued bytes in runs, and handles delays, marks and speed
+// changes in order.  Returns the number of microseconds until the next
+// entry is due, or 0 once the queue is empty.
+uint32_t Thermal_Pipeline::service() {
+  uint8_t  run[32];
+  size_t   len  = 0;
+  uint32_t t    = tail.load(std::memory_order_relaxed), entry;
+  int32_t  wait = 0;
+
+  while(t != head.load(std::memory_order_acquire)) {
+    entry = queue[t & PIPE_MASK];
+    if((entry & PIPE_KIND) == PIPE_BYTE) {
+      if(!len && ((wait = (int32_t)(due - outClock->micros())) > 0)) break;
+      run[len++] = entry;
+      t++;
+      if(len == sizeof(run)) {
+        send(run, len);
+        len = 0;
+        tail.store(t, std::memory_order_release);
+        signal();
+      }
+      continue;
+    }
+    if(len) {                      // Bytes before it go first
+      send(run, len);
+      len = 0;
+    }
+    if(((entry & PIPE_KIND) == PIPE_MARK) &&
+      ((wait = (int32_t)(due - outClock->micros())) > 0)) break;
+    switch(entry & PIPE_KIND) {
+     case PIPE_DELAY:
+      due += entry & PIPE_VALUE;
+      break;
+     case PIPE_MARK:
+      completed.store(++marksSeen, std::memory_order_release);
+      if(markCallback) markCallback(marksSeen, markContext);
+      break;
+     case PIPE_BAUD:
+      out->setBaudRate(entry & PIPE_VALUE);
+      break;
+    }
+    t++;
+  }
+  if(len) send(run, len);
+  tail.store(t, std::memory_order_release);
+  signal();
+  return (wait > 0) ? wait : 0;
+}
+
+// Delays count from the end of the last run sent.
+void Thermal_Pipeline::send(const uint8_t *run, size_t len) {
+  out->write(run, len);
+  due = outClock->micros();
+}
+
+// Services the queue until stop() is called and everything queued has
+// gone out.  Sleeps on the engine's clock between due entries.
+void Thermal_Pipeline::run() {
+  running.store(true, std::memory_order_release);
+  for(;;) {
+    uint32_t wait = service();
+    if(wait) {
+      outClock->sleepMicros(wait);
+    } else {
+      // Check for stop() first: everything queued before it is then
+      // visible, so an empty queue means really done.
+      bool last = stopping.load(std::memory_order_acquire);
+      if(tail.load(std::memory_order_relaxed) ==
+        head.load(std::memory_order_acquire)) {
+        if(last) break;
+        pause();
+      }
+    }
+  }
+  running.store(false, std::memory_order_release);
+  signal();
+}
+
+#ifdef THERMAL_PICO
+
+// Core 1 takes no argument, so only one pipeline runs there at a time.
+static Thermal_Pipeline *core1Pipeline;
+
+// Lets core 0 pause the engine while it writes flash (a Thermal_SpoolFlash
+// log, say), since the engine runs from flash too.
+static void core1Entry() {
+  flash_safe_execute_core_init();
+  core1Pipeline->run();
+  flash_safe_execute_core_deinit();
+}
+
+void Thermal_Pipeline::launch() {
+  stopping.store(false, std::memory_order_relaxed);
+  running.store(true, std::memory_order_relaxed);
+  core1Pipeline = this;
+  multicore_launch_core1(core1Entry);
+}
+
+void Thermal_Pipeline::stop() {
+  stopping.store(true, std::memory_order_release);
+  signal();
+  while(running.load(std::memory_order_acquire)) pause();
+}
+
+// The cores wake each other with SEV; WFE returns at once if an event
+// came in since it last ran, so no wakeup is lost.
+void Thermal_Pipeline::pause() {
+  __wfe();
+}
+
+void Thermal_Pipeline::signal() {
+  __sev();
+}
+
+#else
+
+void Thermal_Pipeline::launch() {
+  stopping.store(false, std::memory_order_relaxed);
+  engine = std::thread(&Thermal_Pipeline::run, this);
+}
+
+void Thermal_Pipeline::stop() {
+  stopping.store(true, std::memory_order_release);
+  if(engine.joinable()) engine.join();
+}
+
+void Thermal_Pipeline::pause() {
+  std::this_thread::sleep_for(std::chrono::microseconds(THERMAL_PIPELINE_POLL));
+}
+
+void Thermal_Pipeline::signal() {
+}
+
+#endif
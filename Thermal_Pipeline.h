@@ -0,0 +1,140 @@
+/*------------------------------------------------------------------------
+  Two-core print pipeline for the Thermal_Print library.
+
+  Normally the core that formats a receipt also waits out every pacing
+  delay.  With a Thermal_Pipeline, Thermal_Print only encodes: its
+  output and its waits go into a lock-free single-producer single-
+  consumer queue, and an engine on the other core (core 1 of the RP2040,
+  or a thread on Linux) sends the bytes to the real transport and does
+  the waiting.  Nothing in the queue is locked: the producer alone
+  moves its head and the engine alone moves its tail.
+
+    Thermal_Pipeline pipe(&uart, &clock);
+    Thermal_Print    printer(pipe.transport(), pipe.clock());
+    printer.begin();
+    pipe.launch();                 // Engine on core 1 / its own thread
+    printer.println("Hello");      // Returns once queued
+    printer.drain();               // Includes the printing time...
+    uint32_t id = pipe.mark();     // ...in what this mark waits for
+    pipe.wait(id);                 // (or poll pipe.done(id))
+
+  When the queue is full the printer blocks until the engine frees up
+  room, so a slow printer holds back the application rather than
+  losing output.  Status queries (requestStatus(), probeBaud()) and
+  flow control need replies in real time and aren't available through
+  the pipeline; call begin() before launch().
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Pipeline_H
+#define Thermal_Pipeline_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "Thermal_Print.h"
+#ifndef THERMAL_PICO
+#include <thread>
+#endif
+
+// Queue entries (bytes, delays and marks); must be a power of two.
+#ifndef THERMAL_PIPELINE_SIZE
+#define THERMAL_PIPELINE_SIZE 1024
+#endif
+// How often an idle engine looks for work where it can't be woken (us).
+#ifndef THERMAL_PIPELINE_POLL
+#define THERMAL_PIPELINE_POLL 200
+#endif
+
+// Called on the engine's core as each mark is reached.
+typedef void (*Thermal_MarkCallback)(uint32_t id, void *ctx);
+
+class Thermal_Pipeline {
+
+ public:
+
+  Thermal_Pipeline(Thermal_Transport *transport, Thermal_Clock *clock);
+  ~Thermal_Pipeline();
+
+  // Application side: give these to the Thermal_Print.
+  Thermal_Transport *transport() { return &input; }
+  Thermal_Clock     *clock() { return &timeline; }
+  uint32_t
+    mark();                         // Id done once output so far is
+  bool
+    done(uint32_t id);              // Output up to mark 'id' handled
+  void
+    wait(uint32_t id),              // Block until done(id)
+    onMark(Thermal_MarkCallback callback, void *ctx=NULL);
+  size_t
+    room();                         // Entries free in the queue
+
+  // Engine side.
+  uint32_t
+    service();                      // Send what's due; us until next
+  void
+    run(),                          // Engine loop, until stop()
+    launch(),                       // run() on core 1 / a new thread
+    stop();                         // Finish queued output, end run()
+
+ private:
+
+  // Queues everything Thermal_Print sends.  flush() is left a no-op so
+  // that drain() doesn't wait on the engine; a mark() does that...
+  class Input : public Thermal_Transport {
+   public:
+    Thermal_Pipeline *owner;
+    bool   begin(uint32_t baud);
+    void   setBaudRate(uint32_t baud);
+    void   write(const uint8_t *buf, size_t len);
+    size_t writable() { return owner->room(); }
+    int    read() { return -1; }
+    bool   supportsBaud(uint32_t baud);
+  };
+  // ...and queues its waits as delays for the engine, without waiting.
+  class Timeline : public Thermal_Clock {
+   public:
+    Thermal_Pipeline *owner;
+    uint32_t now;
+    uint32_t micros() { return now; }
+    void     sleepMicros(uint32_t us);
+  };
+
+  Input
+    input;
+  Timeline
+    timeline;
+  Thermal_Transport
+    *out;          // Real transport, used by the engine only
+  Thermal_Clock
+    *outClock;     // Real clock, likewise
+  Thermal_MarkCallback
+    markCallback;
+  void
+    *markContext;
+  uint32_t
+    queue[THERMAL_PIPELINE_SIZE],
+    marks,         // Marks issued (producer)
+    marksSeen,     // Marks reached (engine)
+    due;           // Engine time the next byte may go
+  std::atomic<uint32_t>
+    head,          // Entries pushed; written by the producer only
+    tail,          // Entries handled; written by the engine only
+    completed;     // Last mark reached
+  std::atomic<bool>
+    stopping,
+    running;
+#ifndef THERMAL_PICO
+  std::thread
+    engine;
+#endif
+
+  void
+    push(uint32_t entry),
+    send(const uint8_t *run, size_t len),
+    pause(),                        // Wait for the other side
+    signal();                       // Wake the other side
+};
+
+#endif // Thermal_Pipeline_H
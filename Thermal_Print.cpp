@@ -29,18 +29,20 @@
 #include <ctype.h>
 #include <math.h> 
 #include <unistd.h>
-#include "pico/stdlib.h"
-#include "hardware/uart.h"
 #include "Thermal_Print.h"
-
-#define UART_ID uart0
-#define BAUD_RATE 19200
-//#define BAUDRATE 19200
+#include "Thermal_Template.h"
+#ifdef THERMAL_PICO
+#include "Thermal_Pico.h"
+#else
+#include "Thermal_Linux.h"
+#endif
 
 #define ASCII_TAB '\t' // Horizontal tab
 #define ASCII_LF  '\n' // Line feed
 #define ASCII_FF  '\f' // Form feed
 #define ASCII_CR  '\r' // Carriage return
+#define ASCII_DLE  16  // Data link escape
+#define ASCII_EOT   4  // End of transmission
 #define ASCII_DC2  18  // Device control 2
 #define ASCII_ESC  27  // Escape
 #define ASCII_FS   28  // Field separator
@@ -57,50 +59,483 @@
 // continue with other duties (e.g. receiving or decoding an image)
 // while the printer physically completes the task.
 
-// Number of microseconds to issue one byte to the printer.  11 bits
-// (not 8) to accommodate idle, start and stop bits.  Idle time might
-// be unnecessary, but erring on side of caution here.
-#define BYTE_TIME (((11L * 1000000L) + (BAUD_RATE / 2)) / BAUD_RATE)
+// The number of microseconds to issue one byte to the printer, byteTime,
+// depends on the baud rate and is worked out in setBaudRate().
 
 // === Character commands ===
 
-#define INVERSE_MASK       (1 << 1) // Not in 2.6.8 firmware (see inverseOn())
+#define INVERSE_MASK       (1 << 1) // Pre-2.6.8 firmware only (see inverseOn())
 #define UPDOWN_MASK        (1 << 2)
 #define BOLD_MASK          (1 << 3)
 #define DOUBLE_HEIGHT_MASK (1 << 4)
 #define DOUBLE_WIDTH_MASK  (1 << 5)
 #define STRIKE_MASK        (1 << 6)
 
+// Settings tracked by the shadow state cache (index into shadow[]).
+#define STATE_PRINTMODE    0 // ESC !
+#define STATE_SIZE         1 // GS !
+#define STATE_JUSTIFY      2 // ESC a
+#define STATE_LINEHEIGHT   3 // ESC 3
+#define STATE_CHARSET      4 // ESC R
+#define STATE_CODEPAGE     5 // ESC t
+#define STATE_UNDERLINE    6 // ESC -
+#define STATE_INVERSE      7 // GS B
+#define STATE_CHARSPACING  8 // ESC SP
+#define STATE_ONLINE       9 // ESC =
+
+// In asynchronous mode each txQueue entry is either a byte for the
+// printer or, with this flag set, the delay (in microseconds, measured
+// from when the previous byte went out) before anything more is sent.
+#define TX_DELAY_FLAG 0x80000000UL
+#define TX_QUEUE_MASK (THERMAL_TX_QUEUE_SIZE - 1)
+
+// Most raster data printBitmap() sends in one chunk: the size of the
+// printer's receive buffer, and of the buffer rows wait in for sending.
+#define RASTER_BUFFER 256
+
+// Characters of UTF-8 text planned in one go by writeUTF8(); at least a
+// full line, so page switches are as few as possible within a line.
+#define UTF8_WINDOW 48
+
+// The printer model: a constant when THERMAL_PROFILE names one at build
+// time, so every use below folds away; otherwise chosen by setProfile().
+#ifdef THERMAL_PROFILE
+#define PROFILE (THERMAL_PROFILE)
+#else
+#define PROFILE (*profile)
+#endif
+#define COLUMNS (PROFILE.headDots / PROFILE.fontWidth) // Normal size text
+
+// Largest dots per module printQR() picks by itself
+#define QR_SCALE_AUTO 6
+
+// Instrumentation (see getStats()) compiles to nothing unless enabled.
+#ifdef THERMAL_STATS
+#define STATS(x) x
+#else
+#define STATS(x)
+#endif
+
+// Without a transport and clock of their own, printers use the Pico's
+// uart0 on GPIO 0 (TX) and 1 (RX); host builds use the system clock and
+// discard output.
+static Thermal_Transport *defaultTransport() {
+#ifdef THERMAL_PICO
+  static Thermal_PicoUART      transport;
+#else
+  static Thermal_NullTransport transport;
+#endif
+  return &transport;
+}
+
+static Thermal_Clock *defaultClock() {
+#ifdef THERMAL_PICO
+  static Thermal_PicoClock  clock;
+#else
+  static Thermal_LinuxClock clock;
+#endif
+  return &clock;
+}
+
+Thermal_Print::Thermal_Print(Thermal_Transport *transport,
+  Thermal_Clock *clock) {
+  this->transport = transport ? transport : defaultTransport();
+  this->clock     = clock     ? clock     : defaultClock();
+  outLen       = 0;
+  printMode    = 0;
+  textSize     = 0;
+  prevByte     = '\n';
+  column       = 0;
+  codePages    = Thermal_CodepagesKnown();
+  qrCache      = NULL;
+#ifndef THERMAL_PROFILE
+  profile      = &Thermal_Profile58mm;
+#endif
+  STATS(resetStats());
+  asyncMode    = false;
+  txActive     = false;
+  txHead       = 0;
+  txTail       = 0;
+  resumeTime   = 0;
+  lastSendTime = 0;
+  batchDepth   = 0;
+  batchLen     = 0;
+  batchTime    = 0;
+  maxChunkHeight  = 255;
+  barcodeHeight   = 50;
+  flowMode        = THERMAL_FLOW_NONE;
+  statusBack      = false;
+  statusFlags     = THERMAL_STATUS_PAPER;
+  statusCount     = 0;
+  statusHead      = 0;
+  statusSerial    = 0;
+  asbLen          = 0;
+  memset(statusDone, 0, sizeof(statusDone));
+  heatDots        = PROFILE.heatDots;
+  baudRate        = BAUD_RATE;
+  byteTime        = ((11L * 1000000L) + (BAUD_RATE / 2)) / BAUD_RATE;
+  dotPrintTime    = PROFILE.dotPrintTime;
+  dotFeedTime     = PROFILE.dotFeedTime;
+  defaultDensityTimes();
+  lineSpacing     = PROFILE.lineHeight - PROFILE.fontHeight;
+  textMetrics();
+  shadowValid     = 0;
+  bytesSuppressed = 0;
+}
+
+// The library remembers the last value it sent for each printer setting
+// and skips commands that wouldn't change anything.  Call this whenever
+// the printer may have lost those settings behind the library's back
+// (reset() and wake() already do).
+void Thermal_Print::invalidateState() {
+  shadowValid = 0;
+}
+
+// Records that a setting is about to be sent.  Returns false, and counts
+// the 'len' command bytes saved, if the printer already has that value.
+bool Thermal_Print::stateChange(uint8_t field, uint8_t value, uint8_t len) {
+  if((shadowValid & (1 << field)) && (shadow[field] == value)) {
+    bytesSuppressed += len;
+    return false;
+  }
+  shadow[field]  = value;
+  shadowValid   |= (1 << field);
+  return true;
+}
+
+// Total command bytes skipped by the shadow state cache.
+unsigned long Thermal_Print::getSuppressedBytes() {
+  return bytesSuppressed;
+}
+
+#ifdef THERMAL_STATS
+// Instrumentation, for finding out where print time goes.  The counters
+// cover everything since the printer object was created or resetStats()
+// was last called; getStats() copies them out.
+void Thermal_Print::getStats(Thermal_Stats *stats) {
+  *stats = this->stats;
+}
+
+void Thermal_Print::resetStats() {
+  memset(&stats, 0, sizeof(stats));
+}
+
+// Counts one ESC/GS/DC2/DLE/FS command.  Distinct commands beyond
+// THERMAL_STATS_OPCODES go uncounted.
+void Thermal_Print::countCommand(uint8_t prefix, uint8_t command) {
+  if((prefix != ASCII_ESC) && (prefix != ASCII_GS) && (prefix != ASCII_DC2) &&
+     (prefix != ASCII_DLE) && (prefix != ASCII_FS)) return;
+  uint16_t op = (prefix << 8) | command;
+  for(uint8_t i=0; i<THERMAL_STATS_OPCODES; i++) {
+    Thermal_OpcodeCount *o = &stats.opcodes[i];
+    if(!o->count) o->opcode = op;
+    if(o->opcode == op) {
+      o->count++;
+      return;
+    }
+  }
+}
+
+// Adds a pacing delay to the histogram, bucketed by bit length.
+void Thermal_Print::countDelay(unsigned long x) {
+  uint8_t bucket = 0;
+  while(x && (bucket < (THERMAL_STATS_BUCKETS - 1))) {
+    bucket++;
+    x >>= 1;
+  }
+  stats.delays[bucket]++;
+}
+
+void Thermal_Print::countWait(uint32_t us) {
+  stats.waits++;
+  stats.waitTotal += us;
+  if(us > stats.waitMax) stats.waitMax = us;
+}
+
+void Thermal_Print::countStatus(const Thermal_StatusRequest *r,
+  uint8_t flags) {
+  if(flags & THERMAL_STATUS_TIMEOUT) {
+    stats.statusTimeouts++;
+    return;
+  }
+  uint32_t us = clock->micros() - r->issued;
+  stats.statusReplies++;
+  stats.statusTotal += us;
+  if(us > stats.statusMax) stats.statusMax = us;
+}
+#endif
+
 // This method sets the estimated completion time for a just-issued task.
+// When output is queued, the delay travels with the data and is applied
+// by service() once the preceding byte has actually been sent.  Inside a
+// batch the delays add up and are applied once, after the whole frame.
 void Thermal_Print::timeoutSet(unsigned long x) {
-  resumeTime = time_us_32() + x;
+  if(batchDepth) {
+    batchTime += x;
+  } else if(asyncMode) {
+    STATS(countDelay(x));
+    txPush(TX_DELAY_FLAG | x);
+  } else {
+    STATS(countDelay(x));
+    flushOut();
+    resumeTime = clock->micros() + x;
+  }
 }
 
 // This function waits (if necessary) for the prior task to complete.
+// Nothing to wait for when output is queued; service() does the pacing.
 void Thermal_Print::timeoutWait() {
-  while((long)(time_us_32() - resumeTime) < 0L); // (syntax is rollover-proof)
+  if(asyncMode || batchDepth) return;
+  waitReady();
+}
+
+// Sleeps until printerReady().
+void Thermal_Print::waitReady() {
+  if(printerReady()) return;
+  STATS(uint32_t start = clock->micros());
+  do {
+    int32_t wait = (int32_t)(resumeTime - clock->micros());
+    clock->sleepMicros((!flowMode && (wait > 0)) ? wait : byteTime);
+  } while(!printerReady());
+  STATS(countWait(clock->micros() - start));
+}
+
+// True when the printer can take more data.  With flow control enabled
+// the printer says so itself; otherwise go by the estimated completion
+// time of the last task.
+bool Thermal_Print::printerReady() {
+  switch(flowMode) {
+   case THERMAL_FLOW_BUSY:
+    return !transport->busy();
+   case THERMAL_FLOW_CTS:
+    return true;                   // UART holds off on its own
+  }
+  return (int32_t)(clock->micros() - resumeTime) >= 0; // (rollover-proof)
+}
+
+// The printer can report when it's busy on its DTR pin (GS a with bit 5
+// set), which is far more accurate than the timing estimates above.
+// Wire that pin to a GPIO and use THERMAL_FLOW_BUSY, or to the UART's
+// CTS pin (GPIO 2 or 18 for uart0) and use THERMAL_FLOW_CTS to have the
+// UART itself stall.  THERMAL_FLOW_NONE goes back to timing estimates.
+// Returns false, leaving flow control off, if the transport can't do it
+// (or for an unknown mode).
+bool Thermal_Print::setFlowControl(uint8_t mode, uint8_t pin) {
+  uint8_t requested = mode;
+  drain();
+  if((mode != THERMAL_FLOW_BUSY) && (mode != THERMAL_FLOW_CTS))
+    mode = THERMAL_FLOW_NONE;
+  if(!transport->setFlowControl(mode, pin)) mode = THERMAL_FLOW_NONE;
+  flowMode = mode;
+  writeStatusBack();
+  return flowMode == requested;
+}
+
+// GS a controls both the busy output and automatic status back, so
+// either setting sends both.
+void Thermal_Print::writeStatusBack() {
+  writeBytes(ASCII_GS, 'a',
+    (flowMode ? (1 << 5) : 0) | (statusBack ? 0x0F : 0));
+}
+
+// Sends a single byte, either straight to the UART or into the queue
+// (or into the batch buffer, if one is open).
+void Thermal_Print::txByte(uint8_t c) {
+  if(batchDepth) {
+    if(batchLen == THERMAL_BATCH_SIZE) flushBatch();
+    batchBuf[batchLen++] = c;
+  } else if(asyncMode) {
+    STATS(stats.bytes++);
+    txPush(c);
+  } else {
+    STATS(stats.bytes++);
+    if(outLen == sizeof(outBuf)) flushOut();
+    outBuf[outLen++] = c;
+  }
+}
+
+// Hands collected output to the transport in one go.  Everything sent
+// between pacing points (timeoutSet() calls) goes out as one frame.
+void Thermal_Print::flushOut() {
+  if(outLen) transport->write(outBuf, outLen);
+  outLen = 0;
+}
+
+// Appends one entry to the TX queue, waiting for room if it's full, and
+// starts the TX timer if it isn't already running.  If the clock has no
+// background timers, the queue drains only as service() is called.
+void Thermal_Print::txPush(uint32_t entry) {
+  uint16_t next = (txHead + 1) & TX_QUEUE_MASK;
+  while(next == txTail) {
+    // Queue full.  Normally the timer frees up room, and waiting goes
+    // through the clock, which may have to run the timer itself (when
+    // it fires on the thread that's waiting here); if it isn't running
+    // (none available) drain the queue from here instead.
+    if(!txActive) {
+      uint32_t wait = service();
+      if(wait) clock->sleepMicros(wait);
+    } else {
+      clock->sleepMicros(byteTime);
+    }
+  }
+  txQueue[txHead] = entry;
+  txHead          = next;
+  if(!txActive) {
+    txActive = true;
+    int32_t wait = (int32_t)(resumeTime - clock->micros());
+    if(!clock->startTimer(this, (wait > 0) ? wait : 0)) txActive = false;
+  }
+}
+
+// Transmits whatever queued output is due, in runs of bytes between
+// pacing delays.  Returns the number of microseconds until the next
+// byte may be sent, or 0 once the queue is empty.  Called from the TX
+// timer; safe to call by hand as well, and must be where the clock has
+// no timers.
+uint32_t Thermal_Print::service() {
+  uint8_t  run[32];
+  size_t   len, room;
+  uint32_t entry;
+  int32_t  wait;
+
+  for(;;) {
+    for(len = room = 0; (txTail != txHead) && (len < room || !len); ) {
+      entry = txQueue[txTail];
+      if(entry & TX_DELAY_FLAG) {
+        if(len) break; // Send the run first; delay counts from its end
+        resumeTime = lastSendTime + (entry & ~TX_DELAY_FLAG);
+      } else {
+        if(!len) {
+          if(!printerReady()) {
+            wait = (int32_t)(resumeTime - clock->micros());
+            return (flowMode || (wait <= 0)) ? byteTime : wait;
+          }
+          room = transport->writable();
+          if(!room) return byteTime;
+          if(room > sizeof(run)) room = sizeof(run);
+        }
+        run[len++] = entry;
+      }
+      txTail = (txTail + 1) & TX_QUEUE_MASK;
+    }
+    if(!len) break;
+    transport->write(run, len);
+    lastSendTime = clock->micros();
+  }
+  txActive = false;
+  return 0;
+}
+
+// Number of queued entries (bytes and pacing delays) not yet processed.
+size_t Thermal_Print::pending() {
+  return (txHead - txTail) & TX_QUEUE_MASK;
+}
+
+// Number of microseconds until the printer can take more output without
+// blocking: 0 when the next line or command would go out right away.
+// With async enabled that's whenever the TX queue is at most half full;
+// if no timer is draining the queue, this drains what's due.  Lets one
+// program keep several printers busy (see Thermal_Scheduler).
+uint32_t Thermal_Print::readyIn() {
+  if(batchDepth) return 0;
+  if(asyncMode) {
+    uint32_t wait = 0;
+    if(!txActive && (txTail != txHead)) wait = service();
+    if(pending() < THERMAL_TX_QUEUE_SIZE / 2) return 0;
+    return wait ? wait : byteTime;
+  }
+  flushOut();
+  if(printerReady()) return 0;
+  if(flowMode) return byteTime;
+  // One reading of the clock: it may have passed resumeTime since
+  // printerReady() looked.
+  int32_t left = (int32_t)(resumeTime - clock->micros());
+  return (left > 0) ? left : 0;
+}
+
+// Blocks until all queued output has left the port and the printer has
+// had time to act on it.
+void Thermal_Print::drain() {
+  while(txTail != txHead) {
+    if(!txActive) {
+      uint32_t wait = service();
+      if(wait) clock->sleepMicros(wait);
+    } else {
+      clock->sleepMicros(byteTime); // As in txPush()
+    }
+  }
+  flushOut();
+  waitReady();
+  transport->flush();
+}
+
+// With async enabled, write() and the command methods return as soon
+// as their output is queued; bytes are then sent in the background by a
+// timer alarm using the same pacing as the blocking path.  Call drain()
+// to wait for everything to go out.
+void Thermal_Print::setAsync(bool enable) {
+  if(enable == asyncMode) return;
+  if(!enable) drain();
+  flushOut();
+  lastSendTime = clock->micros();
+  asyncMode    = enable;
+}
+
+// Between beginBatch() and endBatch(), commands and text are collected
+// into one buffer instead of being sent one writeBytes() at a time, then
+// go out as a single frame with one wait beforehand and one combined
+// delay afterward.  Batches nest; only the outermost endBatch() sends.
+void Thermal_Print::beginBatch() {
+  batchDepth++;
+}
+
+void Thermal_Print::endBatch() {
+  if(!batchDepth) return;
+  if(batchDepth == 1) flushBatch();
+  batchDepth--;
+}
+
+// Sends the batch buffer as one paced frame.
+void Thermal_Print::flushBatch() {
+  uint8_t depth = batchDepth;
+  batchDepth = 0;
+  if(batchLen) {
+    timeoutWait();
+    for(uint8_t i=0; i<batchLen; i++) txByte(batchBuf[i]);
+    timeoutSet(batchTime);
+  }
+  batchLen   = 0;
+  batchTime  = 0;
+  batchDepth = depth;
 }
 
 // Wake the printer from a low-energy state.
 void Thermal_Print::wake() {
+  invalidateState();
   timeoutSet(0);   // Reset timeout counter
   writeBytes(255); // Wake
-  sleep_us(50000);
+  timeoutSet(50000);
   writeBytes(ASCII_ESC, '8', 0, 0); // Sleep off (important!)
 }
 
 // Reset printer to default state.
 void Thermal_Print::reset() {
+  beginBatch();
   writeBytes(ASCII_ESC, '@'); // Init command
+  invalidateState();
   prevByte      = '\n';       // Treat as if prior line is blank
   column        =    0;
-  maxColumn     =   32;
-  charHeight    =   24;
-  lineSpacing   =    6;
+  textSize      =    0;
+  barcodeHeight =   50;
+  lineSpacing   = PROFILE.lineHeight - PROFILE.fontHeight;
+  textMetrics();
   // Configure tab stops on recent printers
-  writeBytes(ASCII_ESC, 'D'); // Set tab stops...
-  writeBytes( 4,  8, 12, 16); // ...every 4 columns,
-  writeBytes(20, 24, 28,  0); // 0 marks end-of-list.
+  if(PROFILE.features & THERMAL_FEATURE_TABS) {
+    writeBytes(ASCII_ESC, 'D');                 // Set tab stops...
+    for(int c=4; c<COLUMNS; c+=4) writeBytes(c); // ...every 4 columns,
+    writeBytes(0);                              // 0 marks end-of-list.
+  }
+  endBatch();
 }
 
 // Printer performance may vary based on the power supply voltage,
@@ -117,9 +552,101 @@ void Thermal_Print::reset() {
 void Thermal_Print::setTimes(unsigned long p, unsigned long f) {
   dotPrintTime = p;
   dotFeedTime  = f;
+  defaultDensityTimes();
 }
 
-void Thermal_Print::begin(uint8_t heatTime) {
+#ifndef THERMAL_PROFILE
+// Selects the printer model (see Thermal_Profile.h) at run time, for
+// hosts that drive more than one kind.  Call before begin(); the
+// model's timing replaces any from setTimes().
+void Thermal_Print::setProfile(const Thermal_Profile *p) {
+  profile      = p;
+  heatDots     = p->heatDots;
+  dotPrintTime = p->dotPrintTime;
+  dotFeedTime  = p->dotFeedTime;
+  defaultDensityTimes();
+  textMetrics();
+}
+#endif
+
+// Bitmap rows don't all take dotPrintTime.  The head can only fire
+// (heatDots + 1) * 8 elements at once, so a row is printed in as many
+// heating passes as it needs for its black dots, and a row with none at
+// all just feeds.  Raster timing is modeled as
+//   rowBaseTime + passes * rowPassTime
+// This derives the coefficients from the print and feed times so that a
+// blank row costs dotFeedTime and a solid full-width row costs
+// dotPrintTime.
+void Thermal_Print::defaultDensityTimes() {
+  unsigned long maxPasses = rowPasses(PROFILE.headDots);
+  rowBaseTime = dotFeedTime;
+  rowPassTime = (dotPrintTime > dotFeedTime) ?
+    (dotPrintTime - dotFeedTime) / maxPasses : 0;
+}
+
+// Overrides the raster row time model (see defaultDensityTimes()).
+void Thermal_Print::setDensityTimes(unsigned long base,
+  unsigned long perPass) {
+  rowBaseTime = base;
+  rowPassTime = perPass;
+}
+
+// Fits the raster row time model to measurements: 'times' holds the
+// measured print time (microseconds per row) of test rows with 'dots'
+// black dots each, for n >= 2 samples.  A least squares fit of time to
+// heating passes replaces the model coefficients.  Returns false, with
+// the model left alone, if the samples don't determine a fit.
+bool Thermal_Print::calibrateDensityTimes(const uint16_t *dots,
+  const unsigned long *times, int n) {
+  double sp = 0, st = 0, spp = 0, spt = 0;
+  for(int i=0; i<n; i++) {
+    double p = rowPasses(dots[i]);
+    sp  += p;
+    st  += times[i];
+    spp += p * p;
+    spt += p * times[i];
+  }
+  double denom = n * spp - sp * sp;
+  if((n < 2) || (denom <= 0)) return false;
+  double slope = (n * spt - sp * st) / denom;
+  double base  = (st - slope * sp) / n;
+  if(slope < 0) slope = 0;
+  if(base  < 0) base  = 0;
+  rowPassTime = (unsigned long)(slope + 0.5);
+  rowBaseTime = (unsigned long)(base  + 0.5);
+  return true;
+}
+
+// Number of heating passes needed to fire 'dots' elements.
+unsigned long Thermal_Print::rowPasses(unsigned long dots) {
+  unsigned long group = (heatDots + 1) * 8;
+  return (dots + group - 1) / group;
+}
+
+// Estimated time to print one raster row, from its count of black dots.
+unsigned long Thermal_Print::rowPrintTime(const uint8_t *row, int len) {
+  unsigned long dots = 0;
+  int           i    = 0;
+  // Count a word at a time; compiles to POPCNT/VCNT where available.
+  for(; (i + 4) <= len; i += 4) {
+    uint32_t word;
+    memcpy(&word, row + i, 4);
+    dots += __builtin_popcount(word);
+  }
+  for(; i < len; i++) dots += __builtin_popcount(row[i]);
+  return rowBaseTime + rowPasses(dots) * rowPassTime;
+}
+
+// Sends the ESC 7 print settings; see the notes in begin().
+void Thermal_Print::setHeatConfig(uint8_t dots, uint8_t time,
+  uint8_t interval) {
+  heatDots = dots;
+  writeBytes(ASCII_ESC, '7');     // Esc 7 (print settings)
+  writeBytes(dots, time, interval); // Heating dots, heat time, heat interval
+  defaultDensityTimes();
+}
+
+void Thermal_Print::begin(uint8_t heatTime, uint32_t baud) {
 
   // The printer can't start receiving data immediately upon power up --
   // it needs a moment to cold boot and initialize.  Allow at least 1/2
@@ -127,21 +654,19 @@ void Thermal_Print::begin(uint8_t heatTime) {
   timeoutSet(500000L);
 
   // Set up our UART with the required speed.
-  uart_init(UART_ID, BAUD_RATE);
-
-// Set the TX and RX pins by using the function select on the GPIO
-    // Set datasheet for more information on function select
-    gpio_set_function(0, GPIO_FUNC_UART);
-    gpio_set_function(1, GPIO_FUNC_UART);
+  transport->begin(baud ? baud : BAUD_RATE);
+  setBaudRate(baud ? baud : BAUD_RATE);
 
   wake();
+  if(!baud) probeBaud(); // Printer speed unknown, go find it
+  beginBatch();
   reset();
 
   // ESC 7 n1 n2 n3 Setting Control Parameter Command
   // n1 = "max heating dots" 0-255 -- max number of thermal print head
   //      elements that will fire simultaneously.  Units = 8 dots (minus 1).
   //      Printer default is 7 (64 dots, or 1/6 of 384-dot width), this code
-  //      sets it to 11 (96 dots, or 1/4 of width).
+  //      sets it to the profile's heatDots (11: 96 dots, or 1/4 of width).
   // n2 = "heating time" 3-255 -- duration that heating dots are fired.
   //      Units = 10 us.  Printer default is 80 (800 us), this code sets it
   //      to value passed (default 120, or 1.2 ms -- a little longer than
@@ -149,14 +674,16 @@ void Thermal_Print::begin(uint8_t heatTime) {
   // n3 = "heating interval" 0-255 -- recovery time between groups of
   //      heating dots on line; possibly a function of power supply.
   //      Units = 10 us.  Printer default is 2 (20 us), this code sets it
-  //      to 40 (throttled back due to 2A supply).
+  //      to the profile's heatInterval (40, throttled back due to 2A
+  //      supply).
   // More heating dots = more peak current, but faster printing speed.
   // More heating time = darker print, but slower printing speed and
   // possibly paper 'stiction'.  More heating interval = clearer print,
   // but slower printing speed.
 
-  writeBytes(ASCII_ESC, '7');   // Esc 7 (print settings)
-  writeBytes(11, heatTime, 40); // Heating dots, heat time, heat interval
+  dotPrintTime   = PROFILE.dotPrintTime; // See comments near top of file
+  dotFeedTime    = PROFILE.dotFeedTime;  // for an explanation of these.
+  setHeatConfig(PROFILE.heatDots, heatTime, PROFILE.heatInterval);
 
   // Print density description from manual:
   // DC2 # n Set printing density
@@ -165,107 +692,665 @@ void Thermal_Print::begin(uint8_t heatTime) {
   // D7..D5 of n is used to set the printing break time.  Break time
   // is n(D7-D5)*250us.
   // (Unsure of the default value for either -- not documented)
+  // The profiles use density 10 (100%; can go higher, text is darker but
+  // fuzzy) and break time 2 (500 uS).
 
-#define printDensity   10 // 100% (? can go higher, text is darker but fuzzy)
-#define printBreakTime  2 // 500 uS
-
-  writeBytes(ASCII_DC2, '#', (printBreakTime << 5) | printDensity);
+  writeBytes(ASCII_DC2, '#', (PROFILE.breakTime << 5) | PROFILE.density);
+  endBatch();
 
-  dotPrintTime   = 30000; // See comments near top of file for
-  dotFeedTime    =  2100; // an explanation of these values.
   maxChunkHeight =   255;
 }
 
+// Sets the UART speed, which must match the printer's (see the printer's
+// self-test page), and with it the time allowed per byte.  Returns false,
+// leaving the speed as it was, for a rate of 0 or one the transport
+// can't do.
+bool Thermal_Print::setBaudRate(uint32_t baud) {
+  if(!baud || !transport->supportsBaud(baud)) return false;
+  drain();
+  transport->setBaudRate(baud);
+  baudRate = baud;
+  // Number of microseconds to issue one byte to the printer.  11 bits
+  // (not 8) to accommodate idle, start and stop bits.  Idle time might
+  // be unnecessary, but erring on side of caution here.
+  byteTime = ((11L * 1000000L) + (baud / 2)) / baud;
+  return true;
+}
+
+uint32_t Thermal_Print::getBaudRate() {
+  return baudRate;
+}
+
+// Time allowed for each byte on the wire, set with the baud rate.
+unsigned long Thermal_Print::getByteTime() {
+  return byteTime;
+}
+
+// Waits up to 'timeout' microseconds for a byte from the printer.
+// Returns the byte, or -1 if nothing arrived.
+int Thermal_Print::readByte(unsigned long timeout) {
+  uint32_t start = clock->micros();
+  int      c;
+  do {
+    if((c = transport->read()) >= 0) return c;
+    clock->sleepMicros(byteTime);
+  } while((clock->micros() - start) < timeout);
+  return -1;
+}
+
+// Tries each of the 'n' baud rates in 'rates' (or a list of common
+// speeds if none are given) until the printer answers status requests
+// sensibly: a reply to ESC v, then two identical replies to GS r 1 with
+// their fixed-zero bits (4 and 7) clear.  Returns the rate found, which
+// is left in effect, or 0 (back at the original rate) if none worked.
+// Requires the printer's TX line to be wired to the UART's RX pin.
+uint32_t Thermal_Print::probeBaud(const uint32_t *rates, int n) {
+  static const uint32_t common[] = { 19200, 9600, 38400, 57600, 115200 };
+  uint32_t original = baudRate;
+  int      a, b;
+
+  if(!rates) {
+    rates = common;
+    n     = sizeof(common) / sizeof(common[0]);
+  }
+  for(int i=0; i<n; i++) {
+    if(!setBaudRate(rates[i])) continue;
+    while(transport->read() >= 0); // Discard noise
+    writeBytes(ASCII_ESC, 'v', 0);
+    drain();
+    if(readByte(100000) < 0) continue;
+    writeBytes(ASCII_GS, 'r', 1);
+    drain();
+    a = readByte(100000);
+    writeBytes(ASCII_GS, 'r', 1);
+    drain();
+    b = readByte(100000);
+    if((a >= 0) && (a == b) && !(a & 0x90)) return rates[i];
+  }
+  setBaudRate(original);
+  return 0;
+}
+
 void Thermal_Print::writeBytes(uint8_t a) {
   timeoutWait();
-  write(a);
-  timeoutSet(BYTE_TIME);
+  txByte(a);
+  timeoutSet(byteTime);
 }
 
 void Thermal_Print::writeBytes(uint8_t a, uint8_t b) {
+  STATS(countCommand(a, b));
   timeoutWait();
-  write(a);
-  write(b);
-  timeoutSet(2 * BYTE_TIME);
+  txByte(a);
+  txByte(b);
+  timeoutSet(2 * byteTime);
 }
 
 void Thermal_Print::writeBytes(uint8_t a, uint8_t b, uint8_t c) {
+  STATS(countCommand(a, b));
   timeoutWait();
-  write(a);
-  write(b);
-  write(c);
-  timeoutSet(3 * BYTE_TIME);
+  txByte(a);
+  txByte(b);
+  txByte(c);
+  timeoutSet(3 * byteTime);
 }
 
 void Thermal_Print::writeBytes(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+  STATS(countCommand(a, b));
+  timeoutWait();
+  txByte(a);
+  txByte(b);
+  txByte(c);
+  txByte(d);
+  timeoutSet(4 * byteTime);
+}
+
+void Thermal_Print::writeBytes(const uint8_t *buf, size_t len) {
   timeoutWait();
-  write(a);
-  write(b);
-  write(c);
-  write(d);
-  timeoutSet(4 * BYTE_TIME);
+  for(size_t i=0; i<len; i++) txByte(buf[i]);
+  timeoutSet(len * byteTime);
 }
 
 // The underlying method for all high-level printing (e.g. println()).
-// The inherited Print class handles the rest!
 size_t Thermal_Print::write(uint8_t c) {
+  write(&c, 1);
+  return 1;
+}
 
-  if(c != 0x13) { // Strip carriage returns
-    timeoutWait();
-    // Send out a character without any conversions
-    uart_putc_raw(UART_ID, c);
-    // Send out a character but do CR/LF conversions
-    //uart_putc(UART_ID, 'B');
-    unsigned long d = BYTE_TIME;
+// Prints a run of text.  Every character goes out in one pass: the text
+// is cut into frames at each line end (newline or wrap at maxColumn),
+// and each frame is sent with a single wait beforehand and a single
+// pacing delay covering its bytes and the line it completes.  Paces
+// exactly like writing the characters one at a time.
+size_t Thermal_Print::write(const uint8_t *buffer, size_t size) {
+  unsigned long d    = 0;
+  bool          open = false; // Frame started, delay not yet set
+
+  for(size_t i=0; i<size; i++) {
+    uint8_t c = buffer[i];
+    if(c == 0x13) continue; // Strip carriage returns
+    if(!open) {
+      timeoutWait();
+      open = true;
+    }
+    txByte(c);
+    d += byteTime;
     if((c == '\n') || (column == maxColumn)) { // If newline or wrap
+      STATS(if(c == '\n') stats.newlines++; else stats.wraps++);
       d += (prevByte == '\n') ?
         ((charHeight+lineSpacing) * dotFeedTime) :             // Feed line
         ((charHeight*dotPrintTime)+(lineSpacing*dotFeedTime)); // Text line
       column = 0;
       c      = '\n'; // Treat wrap as newline on next pass
+      timeoutSet(d);
+      d    = 0;
+      open = false;
     } else {
       column++;
     }
-    timeoutSet(d);
     prevByte = c;
   }
+  if(open) timeoutSet(d);
 
-  return 1;
+  return size;
+}
+
+size_t Thermal_Print::write(const char *str) {
+  return write((const uint8_t *)str, strlen(str));
+}
+
+// Formatted printing, as with printf().  Output beyond
+// THERMAL_PRINTF_SIZE - 1 characters is cut off.  Returns the number of
+// characters printed.
+size_t Thermal_Print::printf(const char *format, ...) {
+  char    buf[THERMAL_PRINTF_SIZE];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if(len < 0) return 0;
+  if((size_t)len >= sizeof(buf)) len = sizeof(buf) - 1;
+  return write((const uint8_t *)buf, len);
+}
+
+// Prints UTF-8 text, converting it to the printer's code pages.  Each
+// character is printed from a page that has it, switching pages (ESC t)
+// only when the current page doesn't: the switch goes to the page that
+// covers the most of the text after it, which keeps the number of
+// switches to the minimum possible within each line.  Characters that
+// no allowed page has print as '?'.  Returns the number of bytes of
+// UTF-8 consumed.
+size_t Thermal_Print::writeUTF8(const uint8_t *buffer, size_t size) {
+  const uint8_t *p   = buffer, *end = buffer + size;
+  uint32_t       chars[UTF8_WINDOW];
+  uint64_t       fits[UTF8_WINDOW]; // Pages that have each character
+  uint8_t        out[UTF8_WINDOW];
+  int            page = (shadowValid & (1 << STATE_CODEPAGE)) ?
+                          shadow[STATE_CODEPAGE] : -1;
+  uint64_t       pages = codePages;
+
+  if(!(PROFILE.features & THERMAL_FEATURE_CODEPAGE)) {
+    pages &= THERMAL_CODEPAGE_BIT(CODEPAGE_CP437); // The only page there is
+    page   = CODEPAGE_CP437;
+  }
+
+  while(p < end) {
+    // Decode up to a line's worth, stopping after any newline.
+    int n = 0;
+    while((p < end) && (n < UTF8_WINDOW)) {
+      uint32_t c = Thermal_UTF8Decode(&p, end);
+      fits[n]  = Thermal_CodepageMask(c) & pages;
+      if(c < 0x80) {
+        fits[n] = ~0ULL;            // ASCII is the same on every page
+      } else if(!fits[n]) {
+        c       = '?';              // Nothing has it
+        fits[n] = ~0ULL;
+      }
+      chars[n++] = c;
+      if(c == '\n') break;
+    }
+
+    int len = 0;
+    for(int i=0; i<n; i++) {
+      if((page < 0) || !((fits[i] >> page) & 1)) {
+        if(~fits[i]) {
+          // Current page lacks this one: switch to the page that lasts
+          // longest from here.
+          uint64_t reach = fits[i];
+          for(int j=i+1; (j < n) && (reach & fits[j]); j++) reach &= fits[j];
+          if(len) write(out, len);
+          len  = 0;
+          page = __builtin_ctzll(reach);
+          setCodePage(page);
+        }
+      }
+      out[len++] = (chars[i] < 0x80) ? chars[i] :
+        Thermal_CodepageByte(chars[i], page);
+    }
+    if(len) write(out, len);
+  }
+
+  return size;
+}
+
+size_t Thermal_Print::writeUTF8(const char *str) {
+  return writeUTF8((const uint8_t *)str, strlen(str));
+}
+
+// Limits writeUTF8() to the given code pages (THERMAL_CODEPAGE_BIT()s),
+// for printers that lack some.  All pages with tables are allowed by
+// default.
+void Thermal_Print::setCodePages(uint64_t pages) {
+  codePages = pages & Thermal_CodepagesKnown();
+}
+
+// Text layout.  printRuns() prints a paragraph made of runs of text in
+// different styles, breaking lines between words (a word too long for
+// a line of its own is split) and at newlines.  Each line goes out as
+// one frame with one pacing delay, worked out from the tallest text on
+// it, and styles are only sent where they change.  Bold, size,
+// underline and inverse are set by the runs; afterwards the print mode
+// is back as it was and underline and inverse are off.  Returns the
+// number of lines printed.
+int Thermal_Print::printRuns(const Thermal_Run *runs, uint8_t count,
+  char align) {
+  uint8_t mode  = printMode;
+  TextPos start = { 0, 0 }, end, next;
+  int     lines = 0;
+
+  justify(align);
+  while(nextLine(runs, count, COLUMNS, start, &end, &next)) {
+    unsigned long bytes = 0;
+    beginBatch();
+    uint8_t height = printSpan(runs, start, end, &bytes);
+    endLine(height, bytes);
+    endBatch();
+    start = next;
+    lines++;
+  }
+  endStyle(mode);
+  return lines;
+}
+
+// Number of lines printRuns() would print, without printing anything.
+int Thermal_Print::countLines(const Thermal_Run *runs, uint8_t count) {
+  TextPos start = { 0, 0 }, end;
+  int     lines = 0;
+  while(nextLine(runs, count, COLUMNS, start, &end, &start)) lines++;
+  return lines;
+}
+
+// Prints one row of a table: each cell is fitted to its column's width,
+// in characters, and aligned within it.  A cell too long for its column
+// wraps within the column, making the row more than one line tall.
+// Column widths should add up to no more than maxColumn (32, or 16 for
+// double width text, on 58 mm printers).  'style' (THERMAL_STYLE_* bits)
+// applies to the whole row.  Returns the number of lines printed.
+int Thermal_Print::printRow(const Thermal_Column *columns, uint8_t count,
+  const char * const *cells, uint8_t style) {
+  Thermal_Run cell[THERMAL_TABLE_COLUMNS];
+  TextPos     at[THERMAL_TABLE_COLUMNS], end, next;
+  const char *text[THERMAL_TABLE_COLUMNS];
+  int         len[THERMAL_TABLE_COLUMNS];
+  uint8_t     mode  = printMode;
+  int         lines = 0;
+
+  if(count > THERMAL_TABLE_COLUMNS) count = THERMAL_TABLE_COLUMNS;
+  for(uint8_t i=0; i<count; i++) {
+    cell[i].text  = cells[i] ? cells[i] : "";
+    cell[i].style = 0;
+    at[i].run     = 0;
+    at[i].pos     = 0;
+  }
+
+  applyStyle(style);
+  for(;;) {
+    // Take the next line's worth of each cell; 'last' is the rightmost
+    // column with anything left to print.
+    int last = -1;
+    for(uint8_t i=0; i<count; i++) {
+      text[i] = cell[i].text + at[i].pos;
+      len[i]  = 0;
+      if(nextLine(&cell[i], 1, columns[i].width, at[i], &end, &next)) {
+        len[i] = end.run ? strlen(text[i]) : (end.pos - at[i].pos);
+        at[i]  = next;
+        last   = i;
+      }
+    }
+    if((last < 0) && lines) break;
+
+    unsigned long bytes = 0;
+    beginBatch();
+    for(int i=0; i<=last; i++) {
+      int width = columns[i].width, pad;
+      switch(toupper(columns[i].align)) {
+        case 'R': pad = width - len[i];       break;
+        case 'C': pad = (width - len[i]) / 2; break;
+        default:  pad = 0;                    break;
+      }
+      if(pad < 0) pad = 0;
+      if(i == last) width = pad + len[i]; // No trailing blanks
+      bytes += (width > pad + len[i]) ? width : pad + len[i];
+      for(int x=0; x<pad; x++)              txByte(' ');
+      for(int x=0; x<len[i]; x++)           txByte(text[i][x]);
+      for(int x=pad + len[i]; x<width; x++) txByte(' ');
+    }
+    endLine(charHeight, bytes);
+    endBatch();
+    lines++;
+  }
+  endStyle(mode);
+  return lines;
+}
+
+// Finds the next line of text starting at 'start', for lines 'columns'
+// normal-width characters wide.  Sets 'end' to where the line's text
+// ends and 'next' to where the following line starts (past the break's
+// spaces or newline).  Returns false if there's no text left.
+bool Thermal_Print::nextLine(const Thermal_Run *runs, uint8_t count,
+  uint8_t columns, TextPos start, TextPos *end, TextPos *next) {
+  TextPos p = start, brk = start;
+  int     used = 0;
+  bool    any = false, space = false, canBreak = false;
+
+  while(p.run < count) {
+    char c = runs[p.run].text[p.pos];
+    if(!c) {
+      p.run++;
+      p.pos = 0;
+      continue;
+    }
+    if(c == '\n') {
+      *end = p;
+      p.pos++;
+      *next = p;
+      return true;
+    }
+    int w = (runs[p.run].style & THERMAL_STYLE_WIDE) ? 2 : 1;
+    if(used && ((used + w) > columns)) {
+      if(c == ' ')       *end = p;       // Break right here
+      else if(canBreak)  *end = p = brk; // Back up to the last space
+      else {                             // One long word: split it
+        *end = *next = p;
+        return true;
+      }
+      while(p.run < count) {             // Drop the spaces at the break
+        c = runs[p.run].text[p.pos];
+        if(!c) {
+          p.run++;
+          p.pos = 0;
+        } else if(c == ' ') {
+          p.pos++;
+        } else {
+          break;
+        }
+      }
+      *next = p;
+      return true;
+    }
+    if(c == ' ') {
+      if(!space && used) {
+        brk      = p;
+        canBreak = true;
+      }
+      space = true;
+    } else {
+      space = false;
+    }
+    used += w;
+    any   = true;
+    p.pos++;
+  }
+  *end = *next = p;
+  return any;
+}
+
+// Sends the text between 'start' and 'end', switching styles between
+// runs as needed.  Adds the characters sent to 'bytes' and returns the
+// height of the tallest one (0 if there were none).
+uint8_t Thermal_Print::printSpan(const Thermal_Run *runs, TextPos start,
+  TextPos end, unsigned long *bytes) {
+  uint8_t height = 0;
+  TextPos p      = start;
+
+  while((p.run < end.run) || ((p.run == end.run) && (p.pos < end.pos))) {
+    const char *text = runs[p.run].text;
+    uint16_t    stop = (p.run == end.run) ? end.pos : 0xFFFF;
+    if(text[p.pos]) {
+      applyStyle(runs[p.run].style);
+      if(charHeight > height) height = charHeight;
+      while(text[p.pos] && (p.pos < stop)) {
+        txByte(text[p.pos++]);
+        (*bytes)++;
+      }
+    }
+    if(!text[p.pos]) {
+      p.run++;
+      p.pos = 0;
+    }
+  }
+  return height;
+}
+
+// Ends a line of 'bytes' characters whose tallest text is 'height' dots
+// (0 for a blank line), pacing for the whole line at once.
+void Thermal_Print::endLine(uint8_t height, unsigned long bytes) {
+  txByte('\n');
+  STATS(stats.newlines++);
+  timeoutSet((bytes + 1) * byteTime + (height ?
+    ((height*dotPrintTime)+(lineSpacing*dotFeedTime)) : // Text line
+    ((charHeight+lineSpacing) * dotFeedTime)));         // Feed line
+  column   = 0;
+  prevByte = '\n';
+}
+
+// Sets bold, size, underline and inverse to a THERMAL_STYLE_* style.
+void Thermal_Print::applyStyle(uint8_t style) {
+  printMode &= ~(BOLD_MASK | DOUBLE_HEIGHT_MASK | DOUBLE_WIDTH_MASK);
+  if(style & THERMAL_STYLE_BOLD) printMode |= BOLD_MASK;
+  if(style & THERMAL_STYLE_TALL) printMode |= DOUBLE_HEIGHT_MASK;
+  if(style & THERMAL_STYLE_WIDE) printMode |= DOUBLE_WIDTH_MASK;
+  // Send ESC ! even if unchanged while a GS ! size is in effect, so the
+  // size is the run's own.
+  if(textSize != modeSize(printMode)) shadowValid &= ~(1 << STATE_PRINTMODE);
+  writePrintMode();
+  textMetrics();
+  if(style & THERMAL_STYLE_UNDERLINE) underlineOn();
+  else                                underlineOff();
+  if(style & THERMAL_STYLE_INVERSE)   inverseOn();
+  else                                inverseOff();
+}
+
+// Undoes applyStyle(), going back to print mode 'mode'.
+void Thermal_Print::endStyle(uint8_t mode) {
+  printMode = mode;
+  writePrintMode();
+  textMetrics();
+  underlineOff();
+  inverseOff();
 }
 
 void Thermal_Print::setPrintMode(uint8_t mask) {
   printMode |= mask;
   writePrintMode();
-  charHeight = (printMode & DOUBLE_HEIGHT_MASK) ? 48 : 24;
-  maxColumn  = (printMode & DOUBLE_WIDTH_MASK ) ? 16 : 32;
+  textMetrics();
 }
 
 void Thermal_Print::unsetPrintMode(uint8_t mask) {
   printMode &= ~mask;
   writePrintMode();
-  charHeight = (printMode & DOUBLE_HEIGHT_MASK) ? 48 : 24;
-  maxColumn  = (printMode & DOUBLE_WIDTH_MASK ) ? 16 : 32;
+  textMetrics();
+}
+
+// ESC ! and GS ! both set the character size, and whichever was sent
+// last wins.  textSize is the size in effect, in GS ! form; this is the
+// size the print mode 'mode' sets.
+uint8_t Thermal_Print::modeSize(uint8_t mode) {
+  return ((mode & DOUBLE_WIDTH_MASK) ? 0x10 : 0) |
+    ((mode & DOUBLE_HEIGHT_MASK) ? 0x01 : 0);
+}
+
+// Character height and line width follow the size in effect.
+void Thermal_Print::textMetrics() {
+  charHeight = (textSize & 0x0F) ? PROFILE.fontHeight * 2 : PROFILE.fontHeight;
+  maxColumn  = (textSize & 0xF0) ? COLUMNS / 2 : COLUMNS;
 }
 
+// Sending ESC ! replaces any GS ! size, so GS ! must be sent again.
 void Thermal_Print::writePrintMode() {
-  writeBytes(ASCII_ESC, '!', printMode);
+  if(stateChange(STATE_PRINTMODE, printMode, 3)) {
+    writeBytes(ASCII_ESC, '!', printMode);
+    textSize     = modeSize(printMode);
+    shadowValid &= ~(1 << STATE_SIZE);
+  }
 }
 
-// Check the status of the paper using the printer's self reporting
-// ability.  Returns true for paper, false for no paper.
-// Might not work on all printers!
-bool Thermal_Print::hasPaper() {
-  writeBytes(ASCII_ESC, 'v', 0);
-  int status = -1;
-  for(uint8_t i=0; i<10; i++) {
-    if(uart_is_readable(UART_ID)) {
-      status = uart_getc(UART_ID);
+// Printer status is gathered without blocking: requestStatus() sends a
+// query and returns a handle right away, and pollStatus() (call it from
+// the main loop) parses replies as they arrive, updating getStatus()
+// and completing requests in the order they were made.  A request that
+// goes unanswered for THERMAL_STATUS_TIMEOUT microseconds after leaving
+// completes with THERMAL_STATUS_TIMEOUT set.  Returns 0 if too many
+// requests are already outstanding.
+uint16_t Thermal_Print::requestStatus(uint8_t query,
+  Thermal_StatusCallback callback, void *ctx) {
+  if(statusCount == THERMAL_STATUS_QUEUE) return 0;
+  switch(query) {
+   case THERMAL_QUERY_PAPER:  writeBytes(ASCII_ESC, 'v', 0);       break;
+   case THERMAL_QUERY_COVER:  writeBytes(ASCII_DLE, ASCII_EOT, 2); break;
+   case THERMAL_QUERY_ERROR:  writeBytes(ASCII_DLE, ASCII_EOT, 3); break;
+   case THERMAL_QUERY_SENSOR: writeBytes(ASCII_DLE, ASCII_EOT, 4); break;
+   default: return 0;
+  }
+  if(!++statusSerial) statusSerial = 1; // 0 is never a valid handle
+  Thermal_StatusRequest *r =
+    &statusReq[(statusHead + statusCount++) % THERMAL_STATUS_QUEUE];
+  r->callback = callback;
+  r->ctx      = ctx;
+  r->handle   = statusSerial;
+  r->query    = query;
+  r->started  = false;
+  STATS(r->issued = clock->micros());
+  return statusSerial;
+}
+
+// Result of a requestStatus(): -1 while still waiting, otherwise the
+// THERMAL_STATUS_* flags as of when it completed.  Results of long-ago
+// requests are forgotten; those report the latest known status.
+int Thermal_Print::statusResult(uint16_t handle) {
+  for(uint8_t i=0; i<statusCount; i++) {
+    if(statusReq[(statusHead + i) % THERMAL_STATUS_QUEUE].handle == handle)
+      return -1;
+  }
+  Thermal_StatusDone *d = &statusDone[handle % THERMAL_STATUS_QUEUE];
+  return (d->handle == handle) ? d->flags : getStatus();
+}
+
+// Latest known THERMAL_STATUS_* flags.
+uint8_t Thermal_Print::getStatus() {
+  uint8_t flags = statusFlags;
+  if((flowMode == THERMAL_FLOW_BUSY) && transport->busy())
+    flags |= THERMAL_STATUS_BUSY;
+  return flags;
+}
+
+// Sets or clears one status flag.
+void Thermal_Print::setStatusFlag(uint8_t flag, bool on) {
+  if(on) statusFlags |=  flag;
+  else   statusFlags &= ~flag;
+}
+
+// Retires the oldest outstanding request, reporting 'flags'.
+void Thermal_Print::completeStatus(uint8_t flags) {
+  Thermal_StatusRequest *r    = &statusReq[statusHead];
+  Thermal_StatusDone    *d    = &statusDone[r->handle % THERMAL_STATUS_QUEUE];
+  d->handle = r->handle;
+  d->flags  = flags;
+  statusHead = (statusHead + 1) % THERMAL_STATUS_QUEUE;
+  statusCount--;
+  STATS(countStatus(r, flags));
+  if(r->callback) r->callback(r->handle, flags, r->ctx);
+}
+
+// Processes any status bytes the printer has sent and times out overdue
+// requests.  Returns true if anything was received or completed.
+bool Thermal_Print::pollStatus() {
+  bool progress = false;
+  int  c;
+
+  while((c = transport->read()) >= 0) {
+    progress = true;
+    // Automatic status back arrives unprompted as 4 bytes, the first
+    // marked by bits 0, 1 and 7 clear and bit 4 set.
+    if(statusBack && (asbLen || ((c & 0x93) == 0x10))) {
+      asbBytes[asbLen++] = c;
+      if(asbLen == 4) {
+        asbLen = 0;
+        setStatusFlag(THERMAL_STATUS_COVER_OPEN, asbBytes[0] & 0x20);
+        setStatusFlag(THERMAL_STATUS_OVERHEAT,   asbBytes[1] & 0x40);
+        setStatusFlag(THERMAL_STATUS_PAPER,    !(asbBytes[2] & 0x0C));
+      }
+      continue;
+    }
+    if(!statusCount) continue; // Stray byte
+    switch(statusReq[statusHead].query) {
+     case THERMAL_QUERY_PAPER:  // ESC v 0: bit 2 = out of paper
+      setStatusFlag(THERMAL_STATUS_PAPER, !(c & 0x04));
+      break;
+     case THERMAL_QUERY_COVER:  // DLE EOT 2: offline causes
+      setStatusFlag(THERMAL_STATUS_COVER_OPEN, c & 0x04);
+      if(c & 0x20) setStatusFlag(THERMAL_STATUS_PAPER, false);
       break;
+     case THERMAL_QUERY_ERROR:  // DLE EOT 3: auto-recoverable = overheat
+      setStatusFlag(THERMAL_STATUS_OVERHEAT, c & 0x40);
+      break;
+     case THERMAL_QUERY_SENSOR: // DLE EOT 4: bits 5-6 = paper end
+      setStatusFlag(THERMAL_STATUS_PAPER, !(c & 0x60));
+      break;
+    }
+    completeStatus(getStatus());
+  }
+
+  // The timeout runs from when the query has actually left; with output
+  // queued it may still be waiting its turn.  Without a background timer
+  // nothing else moves the queue along, so do it here.
+  if((txTail != txHead) && !txActive) service();
+  while(statusCount) {
+    Thermal_StatusRequest *r = &statusReq[statusHead];
+    if(!r->started) {
+      if(txTail != txHead) break;
+      r->started  = true;
+      r->deadline = clock->micros() + THERMAL_STATUS_TIMEOUT;
     }
-    sleep_us(100000);
+    if((int32_t)(clock->micros() - r->deadline) < 0) break;
+    completeStatus(getStatus() | THERMAL_STATUS_TIMEOUT);
+    progress = true;
   }
+  return progress;
+}
+
+// Has the printer report status changes on its own (ESC/POS automatic
+// status back) so that pollStatus() keeps getStatus() current without
+// any queries.  Not all printers support this.
+void Thermal_Print::setStatusBack(bool enable) {
+  statusBack = enable;
+  asbLen     = 0;
+  writeStatusBack();
+}
 
-  return !(status & 0b00000100);
+// Check the status of the paper using the printer's self reporting
+// ability.  Returns true for paper, false for no paper.  A printer that
+// doesn't answer is assumed to have paper, since not hearing back says
+// nothing about the paper.  Blocks for at most THERMAL_STATUS_TIMEOUT
+// once the query is sent; see requestStatus() for a non-blocking check.
+// Might not work on all printers!
+bool Thermal_Print::hasPaper() {
+  uint16_t handle = requestStatus(THERMAL_QUERY_PAPER);
+  int      status;
+  if(!handle) return getStatus() & THERMAL_STATUS_PAPER;
+  while((status = statusResult(handle)) < 0) {
+    if(!pollStatus()) clock->sleepMicros(byteTime);
+  }
+  return (status & (THERMAL_STATUS_PAPER | THERMAL_STATUS_TIMEOUT)) != 0;
 }
 
 void Thermal_Print::test(){
@@ -276,19 +1361,21 @@ void Thermal_Print::test(){
 void Thermal_Print::testPage() {
   writeBytes(ASCII_DC2, 'T');
   timeoutSet(
-    dotPrintTime * 24 * 26 +      // 26 lines w/text (ea. 24 dots high)
+    dotPrintTime * PROFILE.fontHeight * 26 + // 26 lines w/text
     dotFeedTime * (6 * 26 + 30)); // 26 text lines (feed 6 dots) + blank line
 }
 
 // Take the printer offline. Print commands sent after this will be
 // ignored until 'online' is called.
 void Thermal_Print::offline(){
-  writeBytes(ASCII_ESC, '=', 0);
+  if(stateChange(STATE_ONLINE, 0, 3))
+    writeBytes(ASCII_ESC, '=', 0);
 }
 
 // Take the printer back online. Subsequent print commands will be obeyed.
 void Thermal_Print::online(){
-  writeBytes(ASCII_ESC, '=', 1);
+  if(stateChange(STATE_ONLINE, 1, 3))
+    writeBytes(ASCII_ESC, '=', 1);
 }
 
 // Put the printer into a low-energy state immediately.
@@ -305,10 +1392,12 @@ void Thermal_Print::sleepAfter(uint16_t seconds) {
 void Thermal_Print::normal() {
   printMode = 0;
   writePrintMode();
+  textMetrics();
 }
 
 // Reset text formatting parameters.
 void Thermal_Print::setDefault(){
+  beginBatch();
   online();
   justify('L');
   inverseOff();
@@ -319,14 +1408,23 @@ void Thermal_Print::setDefault(){
   setSize('s');
   setCharset();
   setCodePage();
+  endBatch();
 }
 
+// Firmware 2.68 and later only has GS B; older firmware only the print
+// mode bit.
 void Thermal_Print::inverseOn(){
-  writeBytes(ASCII_GS, 'B', 1);
+  if(!(PROFILE.features & THERMAL_FEATURE_INVERSE))
+    setPrintMode(INVERSE_MASK);
+  else if(stateChange(STATE_INVERSE, 1, 3))
+    writeBytes(ASCII_GS, 'B', 1);
 }
 
 void Thermal_Print::inverseOff(){
-  writeBytes(ASCII_GS, 'B', 0);
+  if(!(PROFILE.features & THERMAL_FEATURE_INVERSE))
+    unsetPrintMode(INVERSE_MASK);
+  else if(stateChange(STATE_INVERSE, 0, 3))
+    writeBytes(ASCII_GS, 'B', 0);
 }
 
 void Thermal_Print::upsideDownOn(){
@@ -376,7 +1474,8 @@ void Thermal_Print::justify(char value){
     case 'C': pos = 1; break;
     case 'R': pos = 2; break;
   }
-  writeBytes(ASCII_ESC, 'a', pos);
+  if(stateChange(STATE_JUSTIFY, pos, 3))
+    writeBytes(ASCII_ESC, 'a', pos);
 }
 
 // Feeds by the specified number of lines
@@ -401,11 +1500,13 @@ void Thermal_Print::flush() {
 
 void Thermal_Print::underlineOn(uint8_t weight) {
   if(weight > 2) weight = 2;
-  writeBytes(ASCII_ESC, '-', weight);
+  if(stateChange(STATE_UNDERLINE, weight, 3))
+    writeBytes(ASCII_ESC, '-', weight);
 }
 
 void Thermal_Print::underlineOff() {
-  writeBytes(ASCII_ESC, '-', 0);
+  if(stateChange(STATE_UNDERLINE, 0, 3))
+    writeBytes(ASCII_ESC, '-', 0);
 }
 
 void Thermal_Print::tab() {
@@ -414,55 +1515,346 @@ void Thermal_Print::tab() {
 }
 
 void Thermal_Print::setCharSpacing(int spacing) {
-  writeBytes(ASCII_ESC, ' ', spacing);
+  if(stateChange(STATE_CHARSPACING, spacing, 3))
+    writeBytes(ASCII_ESC, ' ', spacing);
 }
 
 // Alters some chars in ASCII 0x23-0x7E range; see datasheet
 void Thermal_Print::setCharset(uint8_t val) {
   if(val > 15) val = 15;
-  writeBytes(ASCII_ESC, 'R', val);
+  if(stateChange(STATE_CHARSET, val, 3))
+    writeBytes(ASCII_ESC, 'R', val);
 }
 
 // Selects alt symbols for 'upper' ASCII values 0x80-0xFF
 void Thermal_Print::setCodePage(uint8_t val) {
   if(val > 47) val = 47;
-  writeBytes(ASCII_ESC, 't', val);
+  if(stateChange(STATE_CODEPAGE, val, 3))
+    writeBytes(ASCII_ESC, 't', val);
 }
 
 void Thermal_Print::setLineHeight(int val) {
-  if(val < 24) val = 24;
-  lineSpacing = val - 24;
+  if(val < PROFILE.fontHeight) val = PROFILE.fontHeight;
+  lineSpacing = val - PROFILE.fontHeight;
 
   // The printer doesn't take into account the current text height
   // when setting line height, making this more akin to inter-line
   // spacing.  Default line spacing is 30 (char height of 24, line
   // spacing of 6).
-  writeBytes(ASCII_ESC, '3', val);
+  if(stateChange(STATE_LINEHEIGHT, val, 3))
+    writeBytes(ASCII_ESC, '3', val);
 }
 
 void Thermal_Print::setMaxChunkHeight(int val) {
+  if(val <   1) val =   1;
+  if(val > 255) val = 255; // Row count is a single byte in DC2 *
   maxChunkHeight = val;
 }
 
+// Row source for bitmaps held entirely in memory: no copying, just
+// point at the row.
+struct BitmapRows {
+  const uint8_t *bitmap;
+  int            rowBytes;
+};
+
+static const uint8_t *bitmapRow(uint16_t y, uint8_t *, void *ctx) {
+  BitmapRows *rows = (BitmapRows *)ctx;
+  return rows->bitmap + (size_t)y * rows->rowBytes;
+}
+
+// Prints a 1-bit-per-pixel bitmap, MSB leftmost, each row padded to a
+// whole number of bytes.  Anything wider than the print head is clipped.
+void Thermal_Print::printBitmap(int w, int h, const uint8_t *bitmap) {
+  BitmapRows rows = { bitmap, (w + 7) / 8 };
+  printBitmap(w, h, bitmapRow, &rows);
+}
+
+// Row source for printQR(): the symbol, offset to follow justify().
+struct QRRows {
+  const Thermal_QR *qr;
+  int               scale, offset;
+};
+
+static const uint8_t *qrRow(uint16_t y, uint8_t *buf, void *ctx) {
+  QRRows *rows = (QRRows *)ctx;
+  return rows->qr->row(y, rows->scale, buf, rows->offset);
+}
+
+// Gives printQR() a cache of recent symbols, so a repeated payload is
+// only encoded once; NULL (the default) encodes every symbol afresh.
+// Printers may share a cache if they don't print QR codes at the same
+// time.
+void Thermal_Print::setQRCache(Thermal_QRCache *cache) {
+  qrCache = cache;
+}
+
+// Prints 'text' as a QR code, generated here and sent as a bitmap,
+// 'scale' dots per module (0 picks the largest that fits, up to
+// QR_SCALE_AUTO).  Symbols come from the setQRCache() cache if there is
+// one.  The symbol is placed as set by justify().  Returns false if the
+// text is too long for THERMAL_QR_VERSION_MAX or the symbol too wide
+// for the paper.
+bool Thermal_Print::printQR(const char *text, uint8_t scale, uint8_t ecc) {
+  Thermal_QR        fresh;
+  const Thermal_QR *qr = &fresh;
+  if(qrCache) {
+    qr = qrCache->get((const uint8_t *)text, strlen(text), ecc);
+  } else if(!fresh.encode((const uint8_t *)text, strlen(text), ecc)) {
+    qr = NULL;
+  }
+  if(!qr) return false;
+  if(!scale) {
+    scale = PROFILE.headDots / qr->pixels(1);
+    if(scale > QR_SCALE_AUTO) scale = QR_SCALE_AUTO;
+  }
+  int w = qr->pixels(scale);
+  if(!scale || (w > PROFILE.headDots)) return false;
+
+  uint8_t pos  = (shadowValid & (1 << STATE_JUSTIFY)) ?
+                   shadow[STATE_JUSTIFY] : 0;
+  QRRows  rows = { qr, scale, (pos == 1) ? (PROFILE.headDots - w) / 2 :
+                              (pos == 2) ? (PROFILE.headDots - w)     : 0 };
+  printBitmap(rows.offset + w, w, qrRow, &rows);
+  return true;
+}
+
+// Pads or cuts 'value' to 'width' bytes, aligned 'L', 'C' or 'R'.
+static void fillSlot(uint8_t *buf, uint8_t width, uint8_t align,
+  const char *value) {
+  size_t len = strlen(value), pad;
+  if(len > width) len = width;
+  pad = width - len;
+  if(align == 'C')      pad /= 2;
+  else if(align != 'R') pad  = 0;
+  memset(buf, ' ', width);
+  memcpy(buf + pad, value, len);
+}
+
+// Prints a template recorded by Thermal_TemplateBuilder, with values[i]
+// (plain text, or NULL for blank) filling slot i.  Each recorded frame
+// goes out as one gathered write straight from the image, followed by
+// its recorded delay; queued or batched output takes the bytes the
+// usual way instead.  The printer is left with whatever settings the
+// template made, so the shadow state cache is invalidated.
+void Thermal_Print::printTemplate(const Thermal_Template *t,
+  const char * const *values, uint8_t count) {
+  Thermal_IOVec  iov[THERMAL_TEMPLATE_IOV];
+  uint8_t        fill[THERMAL_TEMPLATE_FILL];
+  const uint8_t *data = t->bytes();
+  uint32_t       pos  = 0;
+  uint16_t       s    = 0; // Next slot
+  int            n, used;
+
+  flushOut();
+  for(uint16_t i=0; i<t->segments(); i++) {
+    uint32_t end = t->segmentEnd(i);
+    timeoutWait();
+    for(n = used = 0; pos < end; ) {
+      uint32_t at   = (s < t->slots()) ? t->slotOffset(s) : end;
+      uint32_t stop;
+      if(n == THERMAL_TEMPLATE_IOV) {
+        sendPieces(iov, n);
+        n = used = 0;
+      }
+      if(pos < at) {               // Fixed bytes up to the next slot
+        stop          = (at < end) ? at : end;
+        iov[n].data   = data + pos;
+      } else {                     // Slot s (may continue past 'end')
+        uint8_t width = t->slotWidth(s);
+        if(used + width > THERMAL_TEMPLATE_FILL) {
+          sendPieces(iov, n);
+          n = used = 0;
+        }
+        fillSlot(fill + used, width, t->slotAlign(s),
+          ((s < count) && values[s]) ? values[s] : "");
+        stop          = (at + width < end) ? at + width : end;
+        iov[n].data   = fill + used + (pos - at);
+        used         += width;
+        if(stop == at + width) s++;
+      }
+      iov[n++].len = stop - pos;
+      pos          = stop;
+    }
+    sendPieces(iov, n);
+    timeoutSet(t->segmentDelay(i));
+  }
+  invalidateState();
+  prevByte = '\n';
+  column   = 0;
+}
+
+// Sends output recorded earlier (one frame from a template or spooled
+// job) as is, then gives the printer 'delay' microseconds for it.  As
+// with printTemplate(), the printer's settings are then unknown.
+void Thermal_Print::writeEncoded(const uint8_t *data, size_t len,
+  uint32_t delay) {
+  Thermal_IOVec iov = { data, len };
+  flushOut();
+  timeoutWait();
+  sendPieces(&iov, 1);
+  timeoutSet(delay);
+  invalidateState();
+  prevByte = '\n';
+  column   = 0;
+}
+
+// Sends gathered template output: one transport write when nothing is
+// queued or batched, otherwise byte by byte into the queue or batch.
+void Thermal_Print::sendPieces(const Thermal_IOVec *iov, int count) {
+  if(!count) return;
+  if(asyncMode || batchDepth) {
+    for(int i=0; i<count; i++)
+      for(size_t j=0; j<iov[i].len; j++) txByte(iov[i].data[j]);
+    return;
+  }
+  STATS(for(int i=0; i<count; i++) stats.bytes += iov[i].len);
+  transport->writev(iov, count);
+}
+
+// Number of bytes in a raster row up to and including the last one
+// with any black dots; 0 for an all-white row.
+static int rowWidth(const uint8_t *row, int len) {
+  while(len && !row[len - 1]) len--;
+  return len;
+}
+
+// Prints a bitmap whose rows come from 'source' one at a time, each
+// requested exactly once, top to bottom.  Runs of all-white rows are
+// skipped with ESC J paper feeds, which move the paper the same distance
+// far faster than printing blank dots.  The rest is sent as DC2 * raster
+// chunks no taller than maxChunkHeight, each only as wide as its widest
+// row (trailing white bytes are dropped, since rows are left-aligned),
+// and each followed by a pause long enough for the mechanism to print
+// it, going by how many dots each row fires (see defaultDensityTimes()).
+// Rows wait, trimmed, in a RASTER_BUFFER byte buffer until their chunk
+// is complete, so chunks are at most that big even with flow control.
+// The printed result is identical to sending every row in full.
+void Thermal_Print::printBitmap(int w, int h, Thermal_RowSource source,
+  void *ctx) {
+  uint8_t        row[THERMAL_MAX_ROW_BYTES],
+                 chunk[RASTER_BUFFER], // Rows of the chunk, trimmed
+                 widths[RASTER_BUFFER];
+  const uint8_t *data;
+  unsigned long  chunkTime = 0;
+  int            rowBytes, chunkWidth = 0, chunkHeight = 0, used = 0,
+                 width, blank = 0, y;
+
+  rowBytes = (w + 7) / 8; // Round up to next byte boundary
+  if(rowBytes > PROFILE.headDots / 8) rowBytes = PROFILE.headDots / 8;
+  if((rowBytes < 1) || (h < 1)) return;
+
+  for(y = 0; y <= h; y++) {
+    data  = (y < h) ? source(y, row, ctx) : NULL;
+    width = data ? rowWidth(data, rowBytes) : 0;
+
+    // Send the chunk so far if this row ends it: a blank row or the end,
+    // or no room for another row in the printer's 256 byte buffer (no
+    // limit there with flow control; the printer holds off the data
+    // itself) or in ours.
+    if(chunkHeight && (!width || (chunkHeight == maxChunkHeight) ||
+      (used + width > RASTER_BUFFER) || (!flowMode &&
+      ((chunkHeight + 1) * ((width > chunkWidth) ? width : chunkWidth) >
+      RASTER_BUFFER)))) {
+      sendChunk(chunk, widths, chunkHeight, chunkWidth, chunkTime);
+      chunkWidth = chunkHeight = used = 0;
+      chunkTime  = 0;
+    }
+    if(!width) {
+      if(data) blank++;
+      continue;
+    }
+
+    // Feed past any blank rows before it:
+    for(; blank > 0; blank -= 255) feedRows((blank > 255) ? 255 : blank);
+    blank = 0;
+
+    memcpy(chunk + used, data, width);
+    widths[chunkHeight++] = width;
+    used                 += width;
+    chunkTime            += rowPrintTime(data, width);
+    if(width > chunkWidth) chunkWidth = width;
+  }
+  for(; blank > 0; blank -= 255) feedRows((blank > 255) ? 255 : blank);
+  prevByte = '\n';
+  column   =    0;
+}
+
+// Sends 'height' rows kept by printBitmap() as one DC2 * raster chunk
+// 'width' bytes wide, padding each back out with white, then waits
+// 'time' for it to print.
+void Thermal_Print::sendChunk(const uint8_t *rows, const uint8_t *widths,
+  int height, int width, unsigned long time) {
+  uint8_t row[THERMAL_MAX_ROW_BYTES];
+  writeBytes(ASCII_DC2, '*', height, width);
+  for(int i=0; i<height; i++) {
+    memcpy(row, rows, widths[i]);
+    memset(row + widths[i], 0, width - widths[i]);
+    writeBytes(row, width);
+    rows += widths[i];
+  }
+  timeoutSet(time);
+}
+
+// Prints a barcode drawn by the printer itself (GS k), with its text
+// underneath.  'type' is one of the types in Thermal_Print.h.  Firmware
+// without THERMAL_FEATURE_BARCODE takes the older NUL-terminated form
+// and has no CODE93 or CODE128; returns false for those.
+bool Thermal_Print::printBarcode(const char *text, uint8_t type) {
+  bool   counted = PROFILE.features & THERMAL_FEATURE_BARCODE;
+  size_t len     = strlen(text);
+  if((type < UPC_A) || (type > CODE128) || (!counted && (type > CODABAR)))
+    return false;
+  if(len > 255) len = 255;
+
+  feed(1); // Recent firmware can't print barcode w/o feed first???
+  beginBatch();
+  writeBytes(ASCII_GS, 'H', 2);    // Print label below barcode
+  writeBytes(ASCII_GS, 'w', 3);    // Barcode width 3 (0.375/1.0mm thin/thick)
+  writeBytes(ASCII_GS, 'k', counted ? type : type - UPC_A);
+  if(counted) writeBytes(len);
+  writeBytes((const uint8_t *)text, len);
+  if(!counted) writeBytes(0);
+  timeoutSet((barcodeHeight + 40) * dotPrintTime);
+  endBatch();
+  prevByte = '\n';
+  column   = 0;
+  return true;
+}
+
+void Thermal_Print::setBarcodeHeight(uint8_t val) {
+  if(val < 1) val = 1;
+  barcodeHeight = val;
+  writeBytes(ASCII_GS, 'h', val);
+}
+
 void Thermal_Print::setSize(char value){
   uint8_t size;
   switch(toupper(value)) {
    default:  // Small: standard width and height
-    size       = 0x00;
-    charHeight = 24;
-    maxColumn  = 32;
+    size = 0x00;
     break;
    case 'M': // Medium: double height
-    size       = 0x01;
-    charHeight = 48;
-    maxColumn  = 32;
+    size = 0x01;
     break;
    case 'L': // Large: double width and height
-    size       = 0x11;
-    charHeight = 48;
-    maxColumn  = 16;
+    size = 0x11;
     break;
   }
-  writeBytes(ASCII_GS, '!', size);
-  prevByte = '\n'; // Setting the size adds a linefeed
+  if(!(PROFILE.features & THERMAL_FEATURE_SIZE)) {
+    // Old firmware: the print mode's double height and width instead
+    printMode &= ~(DOUBLE_HEIGHT_MASK | DOUBLE_WIDTH_MASK);
+    if(size & 0x0F) printMode |= DOUBLE_HEIGHT_MASK;
+    if(size & 0xF0) printMode |= DOUBLE_WIDTH_MASK;
+    writePrintMode();
+    textMetrics();
+    return;
+  }
+  if(stateChange(STATE_SIZE, size, 3)) {
+    writeBytes(ASCII_GS, '!', size);
+    prevByte     = '\n'; // Setting the size adds a linefeed
+    shadowValid &= ~(1 << STATE_PRINTMODE); // Its size is replaced
+  }
+  textSize = size;
+  textMetrics();
 }
@@ -31,46 +31,274 @@
 #include <math.h> 
 #include <unistd.h>
 #include <string.h>
+#if !defined(THERMAL_PICO) && defined(LIB_PICO_STDLIB)
+#define THERMAL_PICO 1
+#endif
+#ifdef THERMAL_PICO
 #include "pico/stdlib.h"
 //#include "pico/stdio.h"
 #include "hardware/uart.h"
+#endif
+#include "Thermal_Transport.h"
+#include "Thermal_Codepage.h"
+#include "Thermal_Profile.h"
+#include "Thermal_QR.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Printer's serial speed unless begin() is told otherwise.  Most of these
+// printers ship at 19200; others run anywhere from 9600 to 115200.
+#ifndef BAUD_RATE
+#define BAUD_RATE 19200
+#endif
+
+// Flow control modes for setFlowControl()
+#define THERMAL_FLOW_NONE 0 // Pace output by estimated print times
+#define THERMAL_FLOW_BUSY 1 // Poll printer's busy (DTR) line on a GPIO
+#define THERMAL_FLOW_CTS  2 // Busy line drives the UART's CTS input
+
+// Printer status flags (see requestStatus() and getStatus())
+#define THERMAL_STATUS_PAPER      (1 << 0) // Paper loaded
+#define THERMAL_STATUS_COVER_OPEN (1 << 1)
+#define THERMAL_STATUS_OVERHEAT   (1 << 2) // Head too hot, printing paused
+#define THERMAL_STATUS_BUSY       (1 << 3) // Buffer full (busy line mode)
+#define THERMAL_STATUS_TIMEOUT    (1 << 7) // Query went unanswered
+
+// Barcode types for printBarcode()
+#define UPC_A   65
+#define UPC_E   66
+#define EAN13   67
+#define EAN8    68
+#define CODE39  69
+#define ITF     70
+#define CODABAR 71
+#define CODE93  72 // Not on firmware before 2.64
+#define CODE128 73 // Not on firmware before 2.64
+
+// Status queries for requestStatus()
+#define THERMAL_QUERY_PAPER  0 // ESC v 0
+#define THERMAL_QUERY_COVER  1 // DLE EOT 2
+#define THERMAL_QUERY_ERROR  2 // DLE EOT 3
+#define THERMAL_QUERY_SENSOR 3 // DLE EOT 4
+
+// Max outstanding status queries, and how long to wait for each reply
+// (in microseconds) before giving up on it.
+#ifndef THERMAL_STATUS_QUEUE
+#define THERMAL_STATUS_QUEUE 4
+#endif
+#ifndef THERMAL_STATUS_TIMEOUT
+#define THERMAL_STATUS_TIMEOUT 200000
+#endif
+
+// Called by pollStatus() when a status query completes.
+typedef void (*Thermal_StatusCallback)(uint16_t handle, uint8_t status,
+  void *ctx);
+
+struct Thermal_StatusRequest {
+  Thermal_StatusCallback callback;
+  void                  *ctx;
+  uint32_t               deadline;  // Give up at this clock time
+#ifdef THERMAL_STATS
+  uint32_t               issued;    // When requestStatus() was called
+#endif
+  uint16_t               handle;
+  uint8_t                query;     // THERMAL_QUERY_*
+  bool                   started;   // Query sent; deadline is running
+};
+
+struct Thermal_StatusDone {
+  uint16_t handle;
+  uint8_t  flags;
+};
+
+// Number of entries in the asynchronous transmit queue (see setAsync()).
+// Each entry holds either one byte for the printer or one pacing delay.
+// Must be a power of 2.
+#ifndef THERMAL_TX_QUEUE_SIZE
+#define THERMAL_TX_QUEUE_SIZE 512
+#endif
+
+// Capacity of the command batch buffer (see beginBatch()).  A batch
+// that outgrows it is sent in pieces.
+#ifndef THERMAL_BATCH_SIZE
+#define THERMAL_BATCH_SIZE 64
+#endif
+
+// Longest text printf() can print in one call; more is cut off.
+#ifndef THERMAL_PRINTF_SIZE
+#define THERMAL_PRINTF_SIZE 128
+#endif
+
+// Widest raster row any profile's print head accepts, in bytes (576 dots).
+#define THERMAL_MAX_ROW_BYTES 72
+
+// Supplies row 'y' of a bitmap for printBitmap().  'buf' has room for
+// THERMAL_MAX_ROW_BYTES; the source may fill it and return it, or return
+// a pointer to the row wherever it already lives.  Rows are requested
+// top to bottom, once each, so images can be decoded or generated as
+// they print.
+typedef const uint8_t *(*Thermal_RowSource)(uint16_t y, uint8_t *buf,
+  void *ctx);
+
+#ifdef THERMAL_STATS
+// Counters kept when the library is built with THERMAL_STATS defined
+// (see getStats()).  Without it they, and the code that updates them,
+// are left out entirely.
+#define THERMAL_STATS_OPCODES 32 // Distinct commands counted
+#define THERMAL_STATS_BUCKETS 24 // timeoutSet() histogram, powers of 2 us
+
+struct Thermal_OpcodeCount {
+  uint16_t opcode;          // (prefix << 8) | command, e.g. 0x1B21 = ESC !
+  uint32_t count;           // 0 = unused entry
+};
+
+struct Thermal_Stats {
+  uint32_t bytes;           // Bytes sent to the printer
+  uint32_t newlines;        // Line feeds passed to write()
+  uint32_t wraps;           // Lines that wrapped at the right margin
+  uint32_t waits;           // Times the pacing wait actually blocked
+  uint64_t waitTotal;       // Microseconds spent blocked, all told
+  uint32_t waitMax;         // Longest single wait, microseconds
+  uint32_t delays[THERMAL_STATS_BUCKETS]; // Pacing delays of x us, by
+                            // bit length of x ([0] counts x == 0)
+  uint32_t statusReplies;   // Status queries answered by the printer
+  uint32_t statusTimeouts;  // Status queries that went unanswered
+  uint64_t statusTotal;     // Microseconds from request to reply, total
+  uint32_t statusMax;       // Longest request to reply, microseconds
+  Thermal_OpcodeCount opcodes[THERMAL_STATS_OPCODES];
+};
+#endif
+
+// Text attributes for printRuns() and printRow()
+#define THERMAL_STYLE_BOLD      (1 << 0)
+#define THERMAL_STYLE_UNDERLINE (1 << 1)
+#define THERMAL_STYLE_INVERSE   (1 << 2)
+#define THERMAL_STYLE_WIDE      (1 << 3) // Double width
+#define THERMAL_STYLE_TALL      (1 << 4) // Double height
+
+// A stretch of text in one style, for printRuns().
+struct Thermal_Run {
+  const char *text;
+  uint8_t     style;        // THERMAL_STYLE_* bits
+};
+
+// One column of a table, for printRow().  Rows have at most
+// THERMAL_TABLE_COLUMNS columns.
+struct Thermal_Column {
+  uint8_t width;            // In characters
+  char    align;            // 'L', 'C' or 'R'
+};
+
+#ifndef THERMAL_TABLE_COLUMNS
+#define THERMAL_TABLE_COLUMNS 8
+#endif
+
+// Pre-encoded layouts, for printTemplate() (see Thermal_Template.h)
+class Thermal_Template;
+class Thermal_TemplateBuilder;
+
+// Iovecs and slot bytes printTemplate() gathers into one transport write.
+#define THERMAL_TEMPLATE_IOV   16
+#define THERMAL_TEMPLATE_FILL 256
+
+// Number of printer settings mirrored by the shadow state cache
+// (see invalidateState()).
+#define THERMAL_STATE_COUNT 10
 
 class Thermal_Print {
 
  public:
 
+  Thermal_Print(Thermal_Transport *transport=NULL, Thermal_Clock *clock=NULL);
+
   size_t
-    write(uint8_t c);               // Check Name
+    write(uint8_t c),               // Check Name
+    write(const uint8_t *buffer, size_t size), // Text, paced line by line
+    write(const char *str),
+    printf(const char *format, ...) // Formatted text
+      __attribute__((format(printf, 2, 3))),
+    writeUTF8(const uint8_t *buffer, size_t size), // Unicode text, code
+    writeUTF8(const char *str),     // pages switched as needed
+    pending();                      // Entries still in the TX queue
+  size_t write(const char *buffer, size_t size) {
+    return write((const uint8_t *)buffer, size);
+  }
+  uint16_t
+    requestStatus(uint8_t query=THERMAL_QUERY_PAPER,
+      Thermal_StatusCallback callback=NULL, void *ctx=NULL);
+  int
+    statusResult(uint16_t handle),
+    printRuns(const Thermal_Run *runs, uint8_t count, char align='L'),
+    countLines(const Thermal_Run *runs, uint8_t count), // Lines printRuns
+                                    // would take, without printing
+    printRow(const Thermal_Column *columns, uint8_t count,
+      const char * const *cells, uint8_t style=0); // One table row
+  uint8_t
+    getStatus();
+  uint32_t
+    getBaudRate(),
+    probeBaud(const uint32_t *rates=NULL, int n=0), // Find printer's speed
+    service(),                      // Drain TX queue; returns us until next
+    readyIn();                      // us until more output won't block
+  Thermal_Clock *getClock() { return clock; }
+  unsigned long
+    getByteTime(),                  // us allowed per byte at this baud
+    getSuppressedBytes();           // Bytes skipped as redundant commands
+#ifdef THERMAL_STATS
   void
-    begin(uint8_t heatTime=120),    // Check  Name
+    getStats(Thermal_Stats *stats), // Copy of the counters so far
+    resetStats();
+#endif
+  bool
+    calibrateDensityTimes(const uint16_t *dots,
+      const unsigned long *times, int n); // Fit row time to measurements
+  void
+    begin(uint8_t heatTime=120, uint32_t baud=BAUD_RATE), // 0 = probe
+    beginBatch(),                   // Collect output into one paced frame
     boldOff(),                      // Check  Name
     boldOn(),                       // Check  Name
     doubleHeightOff(),              // Check  Name
     doubleHeightOn(),               // Check  Name
     doubleWidthOff(),               // Check  Name
     doubleWidthOn(),                // Check  Name
+    drain(),                        // Wait for queue and printer to idle
+    endBatch(),                     // Send the frame started by beginBatch
     feed(uint8_t x=1),              // Check  Name
     feedRows(uint8_t),              // Check  Name
     flush(),                        // Check  Name
     inverseOff(),                 // Check  Name
     inverseOn(),                  // Check  Name
+    invalidateState(),            // Forget what the printer is set to
     justify(char value),          // Check  Name
     offline(),                    // Check  Name
+    printBitmap(int w, int h, const uint8_t *bitmap),
+    printBitmap(int w, int h, Thermal_RowSource source, void *ctx=NULL),
+    printTemplate(const Thermal_Template *t, const char * const *values,
+      uint8_t count),             // Stream a template, slots filled in
+    writeEncoded(const uint8_t *data, size_t len,
+      uint32_t delay=0),          // Recorded output, then its delay
     online(),                     // Check  Name
     normal(),                     // Check  Name
     reset(),                      // Check  Name
+    setAsync(bool enable=true),   // Queue output, send in background
+    setBarcodeHeight(uint8_t val=50), // Bar height in dots
     setCharSpacing(int spacing=0), // Check Name
     setCharset(uint8_t val=0),     // Check Name
     setCodePage(uint8_t val=0),   // Check  Name
+    setCodePages(uint64_t pages), // Pages writeUTF8() may use
     setDefault(),                 // Check  Name
+    setDensityTimes(unsigned long base, unsigned long perPass),
+    setHeatConfig(uint8_t dots=11, uint8_t time=120, uint8_t interval=40),
     setLineHeight(int val=30),    // Check  Name
     setMaxChunkHeight(int val=256),// Check Name
+#ifndef THERMAL_PROFILE
+    setProfile(const Thermal_Profile *p), // Printer model; before begin()
+#endif
+    setQRCache(Thermal_QRCache *cache), // Keep printQR() symbols here
     setSize(char value),          // Check  Name
+    setStatusBack(bool enable=true), // Printer reports status unprompted
     setTimes(unsigned long, unsigned long),     // Check  Name
     sleep(),                                    // Check  Name
     sleepAfter(uint16_t seconds),               // Check  Name
@@ -87,30 +315,137 @@ class Thermal_Print {
     upsideDownOn(),               // Check  Name
     wake();                     // Check  Name
   bool
-    hasPaper();                 // Check  Name
+    printBarcode(const char *text, uint8_t type), // Printer-drawn
+    printQR(const char *text, uint8_t scale=0,     // Drawn here; 0 =
+      uint8_t ecc=THERMAL_QR_ECC_M),               // largest that fits
+    setBaudRate(uint32_t baud),   // Change UART speed and byte pacing
+    setFlowControl(uint8_t mode, uint8_t pin=2),
+    hasPaper(),                 // Check  Name
+    pollStatus();               // Handle status replies; call from loop
 
  private:
 
+  friend class Thermal_TemplateBuilder; // Locates slots in pending output
+
+  struct TextPos {                  // Place in a list of runs
+    uint8_t  run;
+    uint16_t pos;
+  };
+
   uint8_t
     printMode,
     prevByte,      // Last character issued to printer
     column,        // Last horizontal column printed
     maxColumn,     // Page width (output 'wraps' at this point)
     charHeight,    // Height of characters, in 'dots'
+    textSize,      // Character size in effect, in GS ! form
     lineSpacing,   // Inter-line spacing (not line height), in dots
-    maxChunkHeight;
+    maxChunkHeight,
+    barcodeHeight, // Last GS h sent
+    heatDots,      // Max heating dots setting (units of 8 dots, minus 1)
+    flowMode,      // THERMAL_FLOW_* setting
+    statusFlags,   // Latest THERMAL_STATUS_* flags
+    statusHead,    // Oldest outstanding request in statusReq
+    statusCount,   // Number of outstanding requests
+    asbLen,        // Bytes of automatic status back packet received
+    asbBytes[4],
+    batchDepth,    // Nesting level of beginBatch() calls
+    batchBuf[THERMAL_BATCH_SIZE],
+    shadow[THERMAL_STATE_COUNT]; // Last value sent for each setting
+  uint16_t
+    batchLen,      // Bytes collected in batchBuf
+    shadowValid,   // Bit n set when shadow[n] is known to be current
+    statusSerial;  // Handle of most recent request
+  Thermal_StatusRequest
+    statusReq[THERMAL_STATUS_QUEUE];
+  Thermal_StatusDone
+    statusDone[THERMAL_STATUS_QUEUE]; // Recent results, by handle
   unsigned long
-    resumeTime,    // Wait until micros() exceeds this before sending byte
+    byteTime,      // Time to issue one byte at baudRate, in microseconds
     dotPrintTime,  // Time to print a single dot line, in microseconds
-    dotFeedTime;   // Time to feed a single dot line, in microseconds
+    dotFeedTime,   // Time to feed a single dot line, in microseconds
+    rowBaseTime,   // Raster row time with no dots to fire, in microseconds
+    rowPassTime,   // Added raster row time per heating pass, microseconds
+    batchTime,     // Pacing delay accumulated by the current batch
+    bytesSuppressed; // Bytes not sent because the setting was unchanged
+  uint64_t
+    codePages;     // THERMAL_CODEPAGE_BIT()s writeUTF8() may switch to
+#ifndef THERMAL_PROFILE
+  const Thermal_Profile
+    *profile;      // Printer model, unless fixed at build time
+#endif
+  uint32_t
+    baudRate,      // Current UART speed
+    resumeTime,    // Wait until micros() exceeds this before sending byte
+    lastSendTime;  // When the most recent queued byte left for the UART
+  Thermal_Transport
+    *transport;
+  Thermal_Clock
+    *clock;
+  Thermal_QRCache
+    *qrCache;      // Recent printQR() symbols, if given one
+  uint16_t
+    outLen;        // Bytes waiting in outBuf
+  uint8_t
+    outBuf[THERMAL_BATCH_SIZE]; // Output collected for the next frame
+  int
+    readByte(unsigned long timeout);
+  bool
+    printerReady(),
+    statusBack,    // Automatic status back enabled
+    asyncMode,     // Output goes through txQueue instead of straight out
+    stateChange(uint8_t field, uint8_t value, uint8_t len);
+#ifdef THERMAL_STATS
+  Thermal_Stats
+    stats;
+  void
+    countCommand(uint8_t prefix, uint8_t command),
+    countDelay(unsigned long x),
+    countWait(uint32_t us),
+    countStatus(const Thermal_StatusRequest *r, uint8_t flags);
+#endif
+  volatile bool
+    txActive;      // A TX alarm is scheduled to drain txQueue
+  volatile uint16_t
+    txHead,        // Next free slot in txQueue (written by caller)
+    txTail;        // Next entry to transmit (written by TX alarm)
+  volatile uint32_t
+    txQueue[THERMAL_TX_QUEUE_SIZE];
   void
+    flushBatch(),                                             // Check  Name
+    defaultDensityTimes(),          // Raster row times from the profile
+    txByte(uint8_t c),                                        // Check  Name
+    txPush(uint32_t entry),                                   // Check  Name
+    flushOut(),                                               // Check  Name
+    sendPieces(const Thermal_IOVec *iov, int count),          // Check  Name
+    sendChunk(const uint8_t *rows, const uint8_t *widths, int height,
+      int width, unsigned long time),
+    waitReady(),                                              // Check  Name
+    writeBytes(const uint8_t *buf, size_t len),               // Check  Name
     writeBytes(uint8_t a),                                    // Check  Name
     writeBytes(uint8_t a, uint8_t b),                         // Check  Name
     writeBytes(uint8_t a, uint8_t b, uint8_t c),              // Check  Name
     writeBytes(uint8_t a, uint8_t b, uint8_t c, uint8_t d),   // Check  Name
     setPrintMode(uint8_t mask),                               // Check  Name
     unsetPrintMode(uint8_t mask),                             // Check  Name
-    writePrintMode();                                         // Check  Name
+    writePrintMode(),                                         // Check  Name
+    textMetrics(),                                            // Check  Name
+    writeStatusBack(),                                        // Check  Name
+    setStatusFlag(uint8_t flag, bool on),                     // Check  Name
+    completeStatus(uint8_t flags),                            // Check  Name
+    applyStyle(uint8_t style),                                // Check  Name
+    endStyle(uint8_t mode),                                   // Check  Name
+    endLine(uint8_t height, unsigned long bytes);             // Check  Name
+  uint8_t
+    modeSize(uint8_t mode),
+    printSpan(const Thermal_Run *runs, TextPos start, TextPos end,
+      unsigned long *bytes);
+  bool
+    nextLine(const Thermal_Run *runs, uint8_t count, uint8_t columns,
+      TextPos start, TextPos *end, TextPos *next);
+  unsigned long
+    rowPasses(unsigned long dots),                            // Check  Name
+    rowPrintTime(const uint8_t *row, int len);                // Check  Name
 
 };
 
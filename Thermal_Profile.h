@@ -0,0 +1,72 @@
+/*------------------------------------------------------------------------
+  Printer model descriptions for the Thermal_Print library.
+
+  A profile gives the print head width, font size, power-on settings,
+  timing and heat defaults and which optional commands a printer model
+  understands.  Thermal_Print uses Thermal_Profile58mm unless told
+  otherwise, either at run time with setProfile(), or at build time by
+  defining THERMAL_PROFILE as the name of a profile (CMake option
+  THERMAL_PROFILE), which turns all the profile's values into constants
+  the compiler folds into the code, at no cost over hard-coded numbers.
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Profile_H
+#define Thermal_Profile_H
+
+#include <stdint.h>
+
+// Optional commands, for Thermal_Profile.features
+#define THERMAL_FEATURE_SIZE     (1 << 0) // GS ! character size; without
+                                          // it, size uses ESC ! doubling
+#define THERMAL_FEATURE_INVERSE  (1 << 1) // GS B reverse printing; without
+                                          // it, ESC ! bit 1 is used
+#define THERMAL_FEATURE_CODEPAGE (1 << 2) // ESC t code pages
+#define THERMAL_FEATURE_TABS     (1 << 3) // ESC D tab stops
+#define THERMAL_FEATURE_BARCODE  (1 << 4) // GS k with a length byte, all
+                                          // types; without it, GS k data
+                                          // ends with a NUL
+
+struct Thermal_Profile {
+  uint16_t headDots;     // Dots across the print head
+  uint8_t  fontWidth;    // Character cell, in dots
+  uint8_t  fontHeight;
+  uint8_t  lineHeight;   // Power-on line height (ESC 3), in dots
+  uint8_t  heatDots;     // ESC 7 used by begin(): max heating dots,
+  uint8_t  heatInterval; // and heating interval (time is begin()'s)
+  uint8_t  density;      // DC2 # used by begin(): print density,
+  uint8_t  breakTime;    // and print break time
+  uint32_t dotPrintTime; // Microseconds to print one dot row of text,
+  uint32_t dotFeedTime;  // and to feed one blank dot row
+  uint8_t  features;     // THERMAL_FEATURE_* bits
+};
+
+// 58 mm printers with firmware 2.68 or later (the Adafruit mini printer).
+static constexpr Thermal_Profile Thermal_Profile58mm = {
+  384, 12, 24, 30, 11, 40, 10, 2, 30000, 2100,
+  THERMAL_FEATURE_SIZE | THERMAL_FEATURE_INVERSE |
+  THERMAL_FEATURE_CODEPAGE | THERMAL_FEATURE_TABS | THERMAL_FEATURE_BARCODE
+};
+
+// 58 mm printers with firmware 2.64 to 2.67: inverse is an ESC ! mode.
+static constexpr Thermal_Profile Thermal_Profile58mmV264 = {
+  384, 12, 24, 30, 11, 40, 10, 2, 30000, 2100,
+  THERMAL_FEATURE_SIZE | THERMAL_FEATURE_CODEPAGE | THERMAL_FEATURE_TABS |
+  THERMAL_FEATURE_BARCODE
+};
+
+// 58 mm printers with firmware older than 2.64: no tab stops, code
+// pages or GS ! sizes, and only the original barcode types.
+static constexpr Thermal_Profile Thermal_Profile58mmOld = {
+  384, 12, 24, 30, 11, 40, 10, 2, 30000, 2100,
+  0
+};
+
+// 80 mm (576 dot) panel printers using the same command set.
+static constexpr Thermal_Profile Thermal_Profile80mm = {
+  576, 12, 24, 30, 11, 40, 10, 2, 30000, 2100,
+  THERMAL_FEATURE_SIZE | THERMAL_FEATURE_INVERSE |
+  THERMAL_FEATURE_CODEPAGE | THERMAL_FEATURE_TABS | THERMAL_FEATURE_BARCODE
+};
+
+#endif // Thermal_Profile_H
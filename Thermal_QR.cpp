@@ -0,0 +1,503 @@
+/*------------------------------------------------------------------------
+  QR code generation for the Thermal_Print library; see Thermal_QR.h.
+  Follows ISO/IEC 18004: byte mode data, Reed-Solomon error correction
+  over GF(256), and the lowest-penalty of the eight data masks.
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <stdlib.h>
+#include "Thermal_QR.h"
+
+// Error correction codewords per block, and number of blocks, for each
+// level (L, M, Q, H) and version (index 0 unused).
+static const int8_t eccPerBlock[4][41] = {
+  { -1,  7, 10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26, 30, 22, 24,
+     28, 30, 28, 28, 28, 28, 30, 30, 26, 28, 30, 30, 30, 30, 30, 30, 30,
+     30, 30, 30, 30, 30, 30, 30 },
+  { -1, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22, 24, 24, 28,
+     28, 26, 26, 26, 26, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+     28, 28, 28, 28, 28, 28, 28 },
+  { -1, 13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24, 20, 30, 24,
+     28, 28, 26, 30, 28, 30, 30, 30, 30, 28, 30, 30, 30, 30, 30, 30, 30,
+     30, 30, 30, 30, 30, 30, 30 },
+  { -1, 17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22, 24, 24, 30,
+     28, 28, 26, 28, 30, 24, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30,
+     30, 30, 30, 30, 30, 30, 30 }
+};
+
+static const int8_t eccBlocks[4][41] = {
+  { -1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  4,  4,  4,  4,  4,  6,  6,
+      6,  6,  7,  8,  8,  9,  9, 10, 12, 12, 12, 13, 14, 15, 16, 17, 18,
+     19, 19, 20, 21, 22, 24, 25 },
+  { -1,  1,  1,  1,  2,  2,  4,  4,  4,  5,  5,  5,  8,  9,  9, 10, 10,
+     11, 13, 14, 16, 17, 17, 18, 20, 21, 23, 25, 26, 28, 29, 31, 33, 35,
+     37, 38, 40, 43, 45, 47, 49 },
+  { -1,  1,  1,  2,  2,  4,  4,  6,  6,  8,  8,  8, 10, 12, 16, 12, 17,
+     16, 18, 21, 20, 23, 23, 25, 27, 29, 34, 34, 35, 38, 40, 43, 45, 48,
+     51, 53, 56, 59, 62, 65, 68 },
+  { -1,  1,  1,  2,  4,  4,  4,  5,  6,  8,  8, 11, 11, 16, 16, 18, 16,
+     19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40, 42, 45, 48, 51, 54, 57,
+     60, 63, 66, 70, 74, 77, 81 }
+};
+
+// Upper bound on rawCodewords() for the largest version
+#define CODEWORDS_MAX \
+  (((16 * THERMAL_QR_VERSION_MAX + 128) * THERMAL_QR_VERSION_MAX + 64) / 8)
+
+// Level as coded in the format information
+static const uint8_t eccFormat[4] = { 1, 0, 3, 2 };
+
+// Codewords (data plus error correction) a version holds.
+static int rawCodewords(int ver) {
+  int bits = (16 * ver + 128) * ver + 64;
+  if(ver >= 2) {
+    int align = ver / 7 + 2;
+    bits -= (25 * align - 10) * align - 55;
+    if(ver >= 7) bits -= 36;
+  }
+  return bits / 8;
+}
+
+static int dataCodewords(int ver, uint8_t ecc) {
+  return rawCodewords(ver) - eccPerBlock[ecc][ver] * eccBlocks[ecc][ver];
+}
+
+// Centers of the alignment patterns along either axis; returns count.
+static int alignments(int ver, uint8_t *pos) {
+  if(ver == 1) return 0;
+  int n    = ver / 7 + 2;
+  int step = (ver == 32) ? 26 : (ver * 4 + n * 2 + 1) / (n * 2 - 2) * 2;
+  pos[0]   = 6;
+  for(int i=n-1, p=ver*4+10; i>=1; i--, p-=step) pos[i] = p;
+  return n;
+}
+
+static uint8_t gfMultiply(uint8_t x, uint8_t y) {
+  int z = 0;
+  for(int i=7; i>=0; i--) {
+    z = (z << 1) ^ ((z >> 7) * 0x11D);
+    z ^= ((y >> i) & 1) * x;
+  }
+  return z;
+}
+
+// Reed-Solomon generator polynomial of the given degree (highest term
+// implied), and the remainder of 'data' divided by it.
+static void rsDivisor(int degree, uint8_t *result) {
+  memset(result, 0, degree);
+  result[degree - 1] = 1;
+  uint8_t root = 1;
+  for(int i=0; i<degree; i++) {
+    for(int j=0; j<degree; j++) {
+      result[j] = gfMultiply(result[j], root);
+      if(j + 1 < degree) result[j] ^= result[j + 1];
+    }
+    root = gfMultiply(root, 0x02);
+  }
+}
+
+static void rsRemainder(const uint8_t *data, int len, const uint8_t *divisor,
+  int degree, uint8_t *result) {
+  memset(result, 0, degree);
+  for(int i=0; i<len; i++) {
+    uint8_t factor = data[i] ^ result[0];
+    memmove(result, result + 1, degree - 1);
+    result[degree - 1] = 0;
+    for(int j=0; j<degree; j++) result[j] ^= gfMultiply(divisor[j], factor);
+  }
+}
+
+// Appends the low 'n' bits of 'val' to a bit buffer.
+static void putBits(uint8_t *buf, int *bit, uint32_t val, int n) {
+  for(int i=n-1; i>=0; i--, (*bit)++) {
+    if((val >> i) & 1) buf[*bit >> 3] |= 0x80 >> (*bit & 7);
+  }
+}
+
+static bool getBit(const uint8_t *rows, int x, int y) {
+  return (rows[y * THERMAL_QR_STRIDE + (x >> 3)] >> (7 - (x & 7))) & 1;
+}
+
+static void setBit(uint8_t *rows, int x, int y, bool on) {
+  uint8_t bit = 0x80 >> (x & 7);
+  if(on) rows[y * THERMAL_QR_STRIDE + (x >> 3)] |=  bit;
+  else   rows[y * THERMAL_QR_STRIDE + (x >> 3)] &= ~bit;
+}
+
+bool Thermal_QR::module(int x, int y) const {
+  return (x >= 0) && (y >= 0) && (x < size) && (y < size) &&
+    getBit(modules, x, y);
+}
+
+void Thermal_QR::set(int x, int y, bool dark) {
+  setBit(modules, x, y, dark);
+}
+
+// Modules taken by function patterns (finders with their separators,
+// timing, alignment, format and version information), which data goes
+// around.  Worked out on the fly rather than kept as a bitmap, to keep
+// encode()'s stack use small.
+struct Thermal_QR::FunctionMap {
+  int    size, version, align;
+  int8_t near[THERMAL_QR_SIZE_MAX]; // Alignment center within 2, or -1
+
+  void init(int ver) {
+    uint8_t pos[7];
+    version = ver;
+    size    = ver * 4 + 17;
+    align   = alignments(ver, pos);
+    memset(near, -1, sizeof(near));
+    for(int i=0; i<align; i++)
+      for(int d=-2; d<=2; d++) near[pos[i] + d] = i;
+  }
+  bool reserved(int x, int y) const {
+    if((x == 6) || (y == 6)) return true;
+    if(((x < 9) || (x >= size - 8)) && (y < 9)) return true;
+    if((x < 9) && (y >= size - 8)) return true;
+    if(version >= 7) {
+      if((x >= size - 11) && (x < size - 8) && (y < 6)) return true;
+      if((y >= size - 11) && (y < size - 8) && (x < 6)) return true;
+    }
+    int ax = near[x], ay = near[y], last = align - 1;
+    return (ax >= 0) && (ay >= 0) && !((ax == 0) && (ay == 0)) &&
+      !((ax == 0) && (ay == last)) && !((ax == last) && (ay == 0));
+  }
+};
+
+// Where the codewords sit: all data first, block after block, then each
+// block's error correction.  The symbol takes them interleaved, byte i
+// of every block in turn; the first 'shortBlocks' blocks have one data
+// byte fewer than the rest.
+struct Thermal_QR::BlockLayout {
+  int numBlocks, eccLen, shortBlocks, shortData, capacity;
+
+  int blockStart(int b) const {
+    return b * shortData + ((b > shortBlocks) ? b - shortBlocks : 0);
+  }
+  int interleaved(int p) const { // Index of the p'th codeword placed
+    if(p < shortData * numBlocks)
+      return blockStart(p % numBlocks) + p / numBlocks;
+    if(p < capacity)
+      return blockStart(shortBlocks + p - shortData * numBlocks) + shortData;
+    p -= capacity;
+    return capacity + (p % numBlocks) * eccLen + p / numBlocks;
+  }
+};
+
+// Encodes 'len' bytes in the smallest version that holds them at level
+// 'ecc'.  Returns false, leaving no symbol, if even the largest
+// (THERMAL_QR_VERSION_MAX) is too small.
+bool Thermal_QR::encode(const uint8_t *data, size_t len, uint8_t ecc) {
+  uint8_t     codewords[CODEWORDS_MAX];
+  FunctionMap map;
+  BlockLayout layout;
+  int         ver, capacity = 0;
+
+  ecc    &= 3;
+  version = 0;
+  for(ver=1; ver<=THERMAL_QR_VERSION_MAX; ver++) {
+    int countBits = (ver < 10) ? 8 : 16;
+    capacity = dataCodewords(ver, ecc);
+    if(4 + countBits + len * 8 <= (size_t)capacity * 8) break;
+  }
+  if(ver > THERMAL_QR_VERSION_MAX) return false;
+  version = ver;
+  size    = ver * 4 + 17;
+
+  // Byte mode segment, terminator, then alternating pad bytes
+  int bit = 0;
+  memset(codewords, 0, capacity);
+  putBits(codewords, &bit, 0x4, 4);
+  putBits(codewords, &bit, len, (ver < 10) ? 8 : 16);
+  for(size_t i=0; i<len; i++) putBits(codewords, &bit, data[i], 8);
+  int end = capacity * 8 - bit;
+  putBits(codewords, &bit, 0, (end < 4) ? end : 4);
+  bit = (bit + 7) & ~7;
+  for(uint8_t pad=0xEC; bit<capacity*8; pad^=0xEC^0x11)
+    putBits(codewords, &bit, pad, 8);
+
+  // Error correction for each block
+  int raw            = rawCodewords(ver);
+  layout.numBlocks   = eccBlocks[ecc][ver];
+  layout.eccLen      = eccPerBlock[ecc][ver];
+  layout.shortBlocks = layout.numBlocks - raw % layout.numBlocks;
+  layout.shortData   = raw / layout.numBlocks - layout.eccLen;
+  layout.capacity    = capacity;
+  uint8_t divisor[30];
+  rsDivisor(layout.eccLen, divisor);
+  for(int b=0; b<layout.numBlocks; b++) {
+    rsRemainder(codewords + layout.blockStart(b),
+      layout.shortData + (b >= layout.shortBlocks), divisor, layout.eccLen,
+      codewords + capacity + b * layout.eccLen);
+  }
+
+  // Draw, then keep whichever mask scores best
+  memset(modules, 0, sizeof(modules));
+  map.init(ver);
+  functionPatterns();
+  placeData(&map, &layout, codewords, raw);
+  uint8_t best = 0;
+  long    bestScore = -1;
+  for(uint8_t mask=0; mask<8; mask++) {
+    applyMask(&map, mask);
+    formatBits(ecc, mask);
+    long score = penalty();
+    if((bestScore < 0) || (score < bestScore)) {
+      best      = mask;
+      bestScore = score;
+    }
+    applyMask(&map, mask); // Undo
+  }
+  applyMask(&map, best);
+  formatBits(ecc, best);
+  return true;
+}
+
+// Finder, timing and alignment patterns, and version information.
+void Thermal_QR::functionPatterns() {
+  for(int i=0; i<size; i++) {
+    set(6, i, !(i & 1));
+    set(i, 6, !(i & 1));
+  }
+
+  static const int8_t corner[3][2] = { { 3, 3 }, { -4, 3 }, { 3, -4 } };
+  for(int c=0; c<3; c++) {
+    int cx = (corner[c][0] < 0) ? size + corner[c][0] : corner[c][0];
+    int cy = (corner[c][1] < 0) ? size + corner[c][1] : corner[c][1];
+    for(int dy=-4; dy<=4; dy++) {
+      for(int dx=-4; dx<=4; dx++) {
+        int x = cx + dx, y = cy + dy;
+        if((x < 0) || (y < 0) || (x >= size) || (y >= size)) continue;
+        int d = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+        set(x, y, (d != 2) && (d != 4));
+      }
+    }
+  }
+
+  uint8_t pos[7];
+  int     n = alignments(version, pos);
+  for(int i=0; i<n; i++) {
+    for(int j=0; j<n; j++) {
+      if(((i == 0) && (j == 0)) || ((i == 0) && (j == n - 1)) ||
+         ((i == n - 1) && (j == 0))) continue; // Finder corners
+      for(int dy=-2; dy<=2; dy++) {
+        for(int dx=-2; dx<=2; dx++) {
+          int d = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+          set(pos[i] + dx, pos[j] + dy, d != 1);
+        }
+      }
+    }
+  }
+
+  if(version >= 7) {
+    uint32_t rem = version;
+    for(int i=0; i<12; i++) rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
+    uint32_t bits = ((uint32_t)version << 12) | rem;
+    for(int i=0; i<18; i++) {
+      bool dark = (bits >> i) & 1;
+      int  a = size - 11 + i % 3, b = i / 3;
+      set(a, b, dark);
+      set(b, a, dark);
+    }
+  }
+}
+
+// Level and mask, BCH-protected, in both copies.
+void Thermal_QR::formatBits(uint8_t ecc, uint8_t mask) {
+  uint32_t data = (eccFormat[ecc] << 3) | mask, rem = data;
+  for(int i=0; i<10; i++) rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+  uint32_t bits = ((data << 10) | rem) ^ 0x5412;
+
+  for(int i=0; i<=5; i++) set(8, i, (bits >> i) & 1);
+  set(8, 7, (bits >> 6) & 1);
+  set(8, 8, (bits >> 7) & 1);
+  set(7, 8, (bits >> 8) & 1);
+  for(int i=9; i<15; i++) set(14 - i, 8, (bits >> i) & 1);
+
+  for(int i=0; i<8; i++)  set(size - 1 - i, 8, (bits >> i) & 1);
+  for(int i=8; i<15; i++) set(8, size - 15 + i, (bits >> i) & 1);
+  set(8, size - 8, true);
+}
+
+// Codeword bits go up and down two-module columns from the right.
+void Thermal_QR::placeData(const FunctionMap *map, const BlockLayout *layout,
+  const uint8_t *codewords, int len) {
+  uint8_t byte = 0;
+  int     i    = 0;
+  for(int right=size-1; right>=1; right-=2) {
+    if(right == 6) right = 5; // Skip the vertical timing pattern
+    for(int vert=0; vert<size; vert++) {
+      for(int j=0; j<2; j++) {
+        int  x  = right - j;
+        bool up = !((right + 1) & 2);
+        int  y  = up ? size - 1 - vert : vert;
+        if(!map->reserved(x, y) && (i < len * 8)) {
+          if(!(i & 7)) byte = codewords[layout->interleaved(i >> 3)];
+          set(x, y, (byte >> (7 - (i & 7))) & 1);
+          i++;
+        }
+      }
+    }
+  }
+}
+
+// XORs mask pattern 'mask' over the data modules (so twice undoes it).
+void Thermal_QR::applyMask(const FunctionMap *map, uint8_t mask) {
+  for(int y=0; y<size; y++) {
+    for(int x=0; x<size; x++) {
+      bool flip;
+      switch(mask) {
+       case 0:  flip = (x + y) % 2 == 0;                   break;
+       case 1:  flip = y % 2 == 0;                         break;
+       case 2:  flip = x % 3 == 0;                         break;
+       case 3:  flip = (x + y) % 3 == 0;                   break;
+       case 4:  flip = (x / 3 + y / 2) % 2 == 0;           break;
+       case 5:  flip = x * y % 2 + x * y % 3 == 0;         break;
+       case 6:  flip = (x * y % 2 + x * y % 3) % 2 == 0;   break;
+       default: flip = ((x + y) % 2 + x * y % 3) % 2 == 0; break;
+      }
+      if(flip && !map->reserved(x, y)) set(x, y, !getBit(modules, x, y));
+    }
+  }
+}
+
+// Run lengths, most recent first, for spotting finder-like patterns
+// (dark:light:dark:light:dark 1:1:3:1:1 with light space either side).
+struct RunHistory {
+  int run[7];
+  int size;
+
+  void add(int len) {
+    if(!run[0]) len += size; // Light border counts as a run before
+    memmove(run + 1, run, 6 * sizeof(int));
+    run[0] = len;
+  }
+  int patterns() const {
+    int  n    = run[1];
+    bool core = (n > 0) && (run[2] == n) && (run[3] == n * 3) &&
+                (run[4] == n) && (run[5] == n);
+    return (core && (run[0] >= n * 4) && (run[6] >= n)) +
+           (core && (run[6] >= n * 4) && (run[0] >= n));
+  }
+  int finish(bool dark, int len) {
+    if(dark) {
+      add(len);
+      len = 0;
+    }
+    add(len + size); // Light border after
+    return patterns();
+  }
+};
+
+// Mask selection score, as the standard defines it: long runs, 2x2
+// blocks, finder lookalikes and dark/light imbalance all cost.
+long Thermal_QR::penalty() const {
+  long result = 0;
+  for(int pass=0; pass<2; pass++) { // Rows, then columns
+    for(int a=0; a<size; a++) {
+      RunHistory h;
+      memset(h.run, 0, sizeof(h.run));
+      h.size    = size;
+      bool color = false;
+      int  run   = 0;
+      for(int b=0; b<size; b++) {
+        bool dark = pass ? getBit(modules, a, b) : getBit(modules, b, a);
+        if(dark == color) {
+          run++;
+          if(run == 5)     result += 3;
+          else if(run > 5) result++;
+        } else {
+          h.add(run);
+          if(!color) result += h.patterns() * 40;
+          color = dark;
+          run   = 1;
+        }
+      }
+      result += h.finish(color, run) * 40;
+    }
+  }
+
+  long dark = 0;
+  for(int y=0; y<size; y++) {
+    for(int x=0; x<size; x++) {
+      bool c = getBit(modules, x, y);
+      dark  += c;
+      if((x < size - 1) && (y < size - 1) && (c == getBit(modules, x + 1, y)) &&
+         (c == getBit(modules, x, y + 1)) && (c == getBit(modules, x + 1, y + 1)))
+        result += 3;
+    }
+  }
+  long total = (long)size * size;
+  long k     = (labs(dark * 20 - total * 10) + total - 1) / total - 1;
+  return result + k * 10;
+}
+
+// Width (and height) of the printed symbol in dots, quiet zone included.
+int Thermal_QR::pixels(int scale, int quiet) const {
+  return (size + quiet * 2) * scale;
+}
+
+// Dot row 'y' of the symbol drawn 'scale' dots per module, packed MSB
+// first into 'buf' after 'offset' blank dots (for centering).  'buf'
+// needs room for (offset + pixels(scale, quiet) + 7) / 8 bytes.
+const uint8_t *Thermal_QR::row(int y, int scale, uint8_t *buf, int offset,
+  int quiet) const {
+  int width = offset + pixels(scale, quiet);
+  memset(buf, 0, (width + 7) / 8);
+  int my = y / scale - quiet;
+  if((my < 0) || (my >= size)) return buf;
+  int x = offset + quiet * scale;
+  for(int mx=0; mx<size; mx++, x+=scale) {
+    if(!getBit(modules, mx, my)) continue;
+    for(int i=0; i<scale; i++) buf[(x + i) >> 3] |= 0x80 >> ((x + i) & 7);
+  }
+  return buf;
+}
+
+// ----------------------------------------------------------------------
+
+Thermal_QRCache::Thermal_QRCache() {
+  clear();
+}
+
+void Thermal_QRCache::clear() {
+  memset(keys, 0, sizeof(keys));
+  memset(lastUse, 0, sizeof(lastUse));
+  memset(lengths, 0, sizeof(lengths));
+  useCount = 0;
+  hits     = misses = 0;
+  for(int i=0; i<THERMAL_QR_CACHE; i++) symbols[i] = Thermal_QR();
+}
+
+// The symbol for this payload, encoding it (in place of the least
+// recently used entry) if it isn't cached.  NULL if it doesn't fit.
+// A payload over THERMAL_QR_CACHE_TEXT bytes never matches, since
+// there's no copy to check it against.
+const Thermal_QR *Thermal_QRCache::get(const uint8_t *data, size_t len,
+  uint8_t ecc) {
+  uint64_t key  = 14695981039346656037ULL; // FNV-1a
+  bool     kept = (len <= THERMAL_QR_CACHE_TEXT);
+  for(size_t i=0; i<len; i++) key = (key ^ data[i]) * 1099511628211ULL;
+  key = (key ^ (len << 2) ^ (ecc & 3)) * 1099511628211ULL;
+
+  int slot = 0;
+  for(int i=0; i<THERMAL_QR_CACHE; i++) {
+    if(kept && symbols[i].getVersion() && (keys[i] == key) &&
+      (lengths[i] == len) && (eccs[i] == ecc) &&
+      !memcmp(texts[i], data, len)) {
+      hits++;
+      lastUse[i] = ++useCount;
+      return &symbols[i];
+    }
+    if(lastUse[i] < lastUse[slot]) slot = i;
+  }
+  misses++;
+  if(!symbols[slot].encode(data, len, ecc)) return NULL;
+  keys[slot]    = key;
+  lengths[slot] = kept ? len : 0xFFFF; // Never matches
+  eccs[slot]    = ecc;
+  lastUse[slot] = ++useCount;
+  if(kept) memcpy(texts[slot], data, len);
+  return &symbols[slot];
+}
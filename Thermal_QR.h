@@ -0,0 +1,120 @@
+/*------------------------------------------------------------------------
+  QR code generation for the Thermal_Print library.
+
+  Thermal_QR encodes text (byte mode, versions 1 to THERMAL_QR_VERSION_MAX,
+  any error correction level) into a module matrix and renders it as
+  packed 1-bit raster rows at any module size, ready for printBitmap().
+  Thermal_QRCache keeps the last few symbols generated, so payloads that
+  repeat (order links, table numbers) are only encoded once.
+  Thermal_Print::printQR() does all of this in one call.
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_QR_H
+#define Thermal_QR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Error correction levels, for encode() and printQR(): L recovers about
+// 7% of the symbol, M 15%, Q 25% and H 30%.
+#define THERMAL_QR_ECC_L 0
+#define THERMAL_QR_ECC_M 1
+#define THERMAL_QR_ECC_Q 2
+#define THERMAL_QR_ECC_H 3
+
+// Largest symbol supported, which sets the memory each Thermal_QR takes.
+// Version 15 (77 x 77 modules) holds up to 520 bytes at level L and 220
+// at level H, and still prints at 4 dots per module on a 58 mm printer.
+#ifndef THERMAL_QR_VERSION_MAX
+#define THERMAL_QR_VERSION_MAX 15
+#endif
+#define THERMAL_QR_SIZE_MAX  (THERMAL_QR_VERSION_MAX * 4 + 17)
+#define THERMAL_QR_STRIDE    ((THERMAL_QR_SIZE_MAX + 7) / 8)
+
+// Quiet (blank) border the standard asks for around a symbol, in modules.
+#define THERMAL_QR_QUIET 4
+
+// Symbols remembered by a Thermal_QRCache, and the longest payload it
+// keeps; longer ones are encoded every time.  A cache takes about
+// THERMAL_QR_CACHE * 900 bytes, and a Thermal_Print only uses one when
+// given it with setQRCache().
+#ifndef THERMAL_QR_CACHE
+#define THERMAL_QR_CACHE 4
+#endif
+#ifndef THERMAL_QR_CACHE_TEXT
+#define THERMAL_QR_CACHE_TEXT 128
+#endif
+
+class Thermal_QR {
+
+ public:
+
+  Thermal_QR() { version = 0; }
+
+  bool
+    encode(const uint8_t *data, size_t len, uint8_t ecc=THERMAL_QR_ECC_M),
+    module(int x, int y) const;       // True for a dark module
+  uint8_t getVersion() const { return version; } // 0 if none encoded
+  uint8_t getSize() const { return size; }       // Modules per side
+  int
+    pixels(int scale, int quiet=THERMAL_QR_QUIET) const; // Dots per side
+  const uint8_t
+    *row(int y, int scale, uint8_t *buf, int offset=0,
+      int quiet=THERMAL_QR_QUIET) const;
+
+ private:
+
+  struct FunctionMap;   // Where data may go (see Thermal_QR.cpp)
+  struct BlockLayout;   // Where each codeword goes
+
+  uint8_t
+    version,
+    size,
+    modules[THERMAL_QR_SIZE_MAX * THERMAL_QR_STRIDE]; // Packed rows
+
+  void
+    set(int x, int y, bool dark),
+    functionPatterns(),
+    formatBits(uint8_t ecc, uint8_t mask),
+    applyMask(const FunctionMap *map, uint8_t mask),
+    placeData(const FunctionMap *map, const BlockLayout *layout,
+      const uint8_t *codewords, int len);
+  long
+    penalty() const;
+};
+
+// The last THERMAL_QR_CACHE symbols encoded, most recently used kept.
+// Entries are found by a 64-bit hash of the payload, its length and
+// the error correction level, then checked against the payload itself.
+class Thermal_QRCache {
+
+ public:
+
+  Thermal_QRCache();
+
+  const Thermal_QR
+    *get(const uint8_t *data, size_t len, uint8_t ecc=THERMAL_QR_ECC_M);
+  void
+    clear();
+  unsigned long
+    hits,
+    misses;
+
+ private:
+
+  Thermal_QR
+    symbols[THERMAL_QR_CACHE];
+  uint64_t
+    keys[THERMAL_QR_CACHE];
+  uint32_t
+    lastUse[THERMAL_QR_CACHE],
+    useCount;
+  uint16_t
+    lengths[THERMAL_QR_CACHE];
+  uint8_t
+    eccs[THERMAL_QR_CACHE],
+    texts[THERMAL_QR_CACHE][THERMAL_QR_CACHE_TEXT]; // Payloads
+};
+
+#endif // Thermal_QR_H
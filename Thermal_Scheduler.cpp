@@ -0,0 +1,97 @@
+/*------------------------------------------------------------------------
+  Runs print jobs on several printers at once; see Thermal_Scheduler.h.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include <string.h>
+#include "Thermal_Scheduler.h"
+
+bool Thermal_TextJob::step(Thermal_Print *p, void *ctx) {
+  Thermal_TextJob *job = (Thermal_TextJob *)ctx;
+  const char      *nl  = strchr(job->text, '\n');
+  size_t           len = nl ? (size_t)(nl - job->text) + 1 : strlen(job->text);
+  p->write(job->text, len);
+  job->text += len;
+  return *job->text != '\0';
+}
+
+Thermal_Scheduler::Thermal_Scheduler() {
+  count = 0;
+  memset(head, 0, sizeof(head));
+  memset(queued, 0, sizeof(queued));
+}
+
+int Thermal_Scheduler::find(Thermal_Print *p) {
+  for(int i=0; i<count; i++) {
+    if(printers[i] == p) return i;
+  }
+  return -1;
+}
+
+// Returns false if THERMAL_SCHEDULER_PRINTERS are already added.
+bool Thermal_Scheduler::add(Thermal_Print *p) {
+  if(find(p) >= 0) return true;
+  if(count == THERMAL_SCHEDULER_PRINTERS) return false;
+  printers[count++] = p;
+  return true;
+}
+
+// Queues a job for printer 'p' (added if it wasn't), to run after any
+// already queued for it.  Returns false if its queue is full.
+bool Thermal_Scheduler::submit(Thermal_Print *p, Thermal_JobStep step,
+  void *ctx) {
+  if(!add(p)) return false;
+  int i = find(p);
+  if(queued[i] == THERMAL_SCHEDULER_JOBS) return false;
+  Job *job  = &jobs[i][(head[i] + queued[i]) % THERMAL_SCHEDULER_JOBS];
+  job->step = step;
+  job->ctx  = ctx;
+  queued[i]++;
+  return true;
+}
+
+// True when printer 'p' (or, with NULL, every printer) has no jobs left
+// and nothing queued to send.
+bool Thermal_Scheduler::idle(Thermal_Print *p) {
+  for(int i=0; i<count; i++) {
+    if(p && (printers[i] != p)) continue;
+    if(queued[i] || printers[i]->pending()) return false;
+  }
+  return true;
+}
+
+// Gives each printer that can take more output right now one step of
+// its current job, taking turns so none starves the others.  Returns
+// how many microseconds until some printer can take more (0 if one
+// already can, or if all are idle); call again then.
+uint32_t Thermal_Scheduler::poll() {
+  uint32_t next = 0;
+  bool     some = false;
+
+  for(int i=0; i<count; i++) {
+    Thermal_Print *p    = printers[i];
+    uint32_t       wait = p->readyIn();
+    if(!wait && queued[i]) {
+      Job *job = &jobs[i][head[i]];
+      if(!job->step(p, job->ctx)) {
+        head[i] = (head[i] + 1) % THERMAL_SCHEDULER_JOBS;
+        queued[i]--;
+      }
+      wait = p->readyIn();
+    }
+    if(!queued[i] && !p->pending()) continue; // Nothing more to do
+    if(!some || (wait < next)) next = wait;
+    some = true;
+  }
+  return next;
+}
+
+// Runs jobs until all are done and all queued output sent, sleeping on
+// the first printer's clock while none can take more.
+void Thermal_Scheduler::run() {
+  while(!idle()) {
+    uint32_t wait = poll();
+    if(wait) printers[0]->getClock()->sleepMicros(wait);
+  }
+}
@@ -0,0 +1,79 @@
+/*------------------------------------------------------------------------
+  Runs print jobs on several printers at once for the Thermal_Print
+  library.
+
+  Each Thermal_Print has its own transport (port and pins) and pacing
+  state, but a program that prints on one and then the other waits out
+  all of the first printer's mechanism time before the second gets any
+  data.  Thermal_Scheduler interleaves them instead: jobs are split
+  into small steps (a line, a command), and a printer's next step runs
+  as soon as that printer can take it, so while one is busy printing
+  the others keep receiving.  Printers with setAsync() take steps for as
+  long as their queues have room.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Scheduler_H
+#define Thermal_Scheduler_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Thermal_Print.h"
+
+#ifndef THERMAL_SCHEDULER_PRINTERS
+#define THERMAL_SCHEDULER_PRINTERS 4 // Printers one scheduler drives
+#endif
+#ifndef THERMAL_SCHEDULER_JOBS
+#define THERMAL_SCHEDULER_JOBS     4 // Jobs waiting per printer
+#endif
+
+// One step of a job: sends a little output (at most one line or
+// paced command, or it will wait inside) and returns true while the job
+// has more to do.
+typedef bool (*Thermal_JobStep)(Thermal_Print *p, void *ctx);
+
+// Job printing text a line at a time.  'text' must stay valid until
+// it's printed; submit with Thermal_TextJob::step and the job as ctx.
+struct Thermal_TextJob {
+  const char *text;
+
+  static bool step(Thermal_Print *p, void *ctx);
+};
+
+class Thermal_Scheduler {
+
+ public:
+
+  Thermal_Scheduler();
+
+  bool
+    add(Thermal_Print *p),          // Printer to schedule jobs on
+    submit(Thermal_Print *p, Thermal_JobStep step, void *ctx=NULL),
+    idle(Thermal_Print *p=NULL);    // No jobs or queued output left
+  uint32_t
+    poll();                         // Run due steps; us until next due
+  void
+    run();                          // Until every job is done
+
+ private:
+
+  struct Job {
+    Thermal_JobStep step;
+    void           *ctx;
+  };
+
+  Thermal_Print
+    *printers[THERMAL_SCHEDULER_PRINTERS];
+  Job
+    jobs[THERMAL_SCHEDULER_PRINTERS][THERMAL_SCHEDULER_JOBS];
+  uint8_t
+    count,                          // Printers added
+    head[THERMAL_SCHEDULER_PRINTERS], // Current job of each
+    queued[THERMAL_SCHEDULER_PRINTERS]; // Jobs waiting for each
+
+  int
+    find(Thermal_Print *p);
+};
+
+#endif // Thermal_Scheduler_H
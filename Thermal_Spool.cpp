@@ -0,0 +1,445 @@
+/*------------------------------------------------------------------------
+  Crash-safe print spooler for the Thermal_Print library; see
+  Thermal_Spool.h.
+
+  The log is a ring of sectors, each starting with an 8-byte header (a
+  magic number and the sector's sequence number, counting up forever).
+  Records follow back to back, 4-byte aligned, never crossing a sector:
+    u8 type, u8 flags, u16 length, u32 job id, u32 check, then
+    length bytes: a u32 value and, for data records, printer output
+  The check (FNV-1a over the rest of the record) catches records torn
+  by a reset.  A job is its data records (one frame each, or part of
+  one), then an END record; PROGRESS records note how many of its data
+  records have printed and DONE that all have.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include <string.h>
+#include "Thermal_Spool.h"
+
+#define SPOOL_MAGIC    0x4C4F5053 // "SPOL"
+#define SPOOL_HEAD     8          // Sector header bytes
+#define RECORD_HEAD    12         // Record header bytes
+#define RECORD_MAX     (RECORD_HEAD + 4 + THERMAL_SPOOL_RECORD + 3)
+
+#define RECORD_DATA     1         // value: delay after it, us
+#define RECORD_END      2         // value: number of data records
+#define RECORD_PROGRESS 3         // value: data records printed
+#define RECORD_DONE     4
+#define RECORD_ERASED   0xFF
+
+#define FLAG_MORE 1               // Frame continues in the next record
+
+#define JOB_FREE    0
+#define JOB_PENDING 1             // Records not yet in the log
+#define JOB_WRITING 2             // Some in the log
+#define JOB_WRITTEN 3             // All in the log, not yet synced
+#define JOB_QUEUED  4             // Safely stored, to print
+
+static uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void set32(uint8_t *p, uint32_t x) {
+  for(int i=0; i<4; i++) p[i] = x >> (i * 8);
+}
+
+// FNV-1a over a record, skipping its check field.
+static uint32_t check(const uint8_t *r, size_t len) {
+  uint32_t h = 2166136261u;
+  for(size_t i=0; i<len; i++) {
+    if((i >= 8) && (i < RECORD_HEAD)) continue;
+    h = (h ^ r[i]) * 16777619u;
+  }
+  return h;
+}
+
+Thermal_Spool::Thermal_Spool(Thermal_SpoolStore *store,
+  Thermal_Print *printer) {
+  this->store   = store;
+  this->printer = printer;
+  bytesWritten  = syncs = 0;
+  sectorBytes   = sectors = 0;
+  current       = -1;
+  midFrame      = false;
+  memset(jobs, 0, sizeof(jobs));
+}
+
+// ----------------------------------------------------------------------
+// Recovery
+
+// Rebuilds the job table from the log: jobs completely stored but not
+// finished printing are queued again, in order, per 'policy'.  Returns
+// false if the store can't hold a log.
+bool Thermal_Spool::begin(uint8_t policy) {
+  uint8_t  head[SPOOL_HEAD];
+  uint32_t newest = 0;
+  bool     any    = false;
+
+  sectorBytes = store->sectorSize();
+  sectors     = sectorBytes ? store->size() / sectorBytes : 0;
+  if((sectors < 2) || (sectorBytes > 0xFFFF) ||
+    (sectorBytes < SPOOL_HEAD + 2 * RECORD_MAX)) return false;
+  memset(jobs, 0, sizeof(jobs));
+  pending.clear();
+  builder.clear();
+  current = -1;
+  nextId  = 1;
+
+  for(uint32_t i=0; i<sectors; i++) {
+    if(!store->read(i * sectorBytes, head, SPOOL_HEAD)) return false;
+    uint32_t seq = get32(head + 4);
+    if((get32(head) != SPOOL_MAGIC) || ((seq % sectors) != i)) continue;
+    if(!any || ((int32_t)(seq - newest) > 0)) newest = seq;
+    any = true;
+  }
+  if(!any) {                       // Fresh store
+    headSeq = (uint32_t)-1;
+    return openSector(0) && store->sync();
+  }
+
+  bool clean = true;
+  for(uint32_t seq = newest - sectors + 1; seq != newest + 1; seq++) {
+    clean = scan(seq, &headOff);
+  }
+  headSeq = newest;
+
+  for(int i=0; i<THERMAL_SPOOL_JOBS; i++) {
+    Job *j = &jobs[i];
+    if(j->state == JOB_WRITTEN) {
+      j->state = JOB_QUEUED;
+      if(policy == THERMAL_SPOOL_REPRINT) j->printed = 0;
+    } else {
+      j->state = JOB_FREE;        // Cut short while being stored
+    }
+  }
+  // Past a torn record the sector can't be appended to; start another.
+  return clean || openSector(newest + 1);
+}
+
+// Replays one sector's records into the job table.  Sets *end to where
+// the next record would go, and returns false if it met a torn one.
+bool Thermal_Spool::scan(uint32_t seq, uint16_t *end) {
+  uint8_t  head[SPOOL_HEAD];
+  uint32_t base = (seq % sectors) * sectorBytes;
+  uint16_t off  = SPOOL_HEAD;
+
+  *end = off;
+  if(!store->read(base, head, SPOOL_HEAD) || (get32(head) != SPOOL_MAGIC) ||
+    (get32(head + 4) != seq)) return true; // Not written (yet)
+
+  while((uint32_t)off + RECORD_HEAD <= sectorBytes) {
+    if(!store->read(base + off, record, 1)) return false;
+    if(record[0] == RECORD_ERASED) break;
+    uint32_t s = seq;
+    uint16_t o = off;
+    if(!readRecord(&s, &o, true) || (s != seq)) return false;
+    uint16_t len   = record[2] | (record[3] << 8);
+    uint32_t id    = get32(record + 4);
+    uint32_t value = get32(record + RECORD_HEAD);
+    Job     *j     = find(id);
+    switch(record[0]) {
+     case RECORD_DATA:
+      if(!j && (j = freeJob())) {
+        j->id      = id;
+        j->seq     = seq;
+        j->off     = off;
+        j->records = j->printed = 0;
+        j->state   = JOB_WRITING;
+      }
+      if(j && (j->state == JOB_WRITING)) j->records++;
+      break;
+     case RECORD_END:
+      if(j) j->state = (j->records == value) ? JOB_WRITTEN : JOB_FREE;
+      break;
+     case RECORD_PROGRESS:
+      if(j && (value > j->printed)) j->printed = value;
+      break;
+     case RECORD_DONE:
+      if(j) j->state = JOB_FREE;
+      break;
+    }
+    if((int32_t)(id - nextId) >= 0) nextId = id + 1;
+    off += (RECORD_HEAD + len + 3) & ~3;
+    *end = off;
+  }
+  return true;
+}
+
+// Reads the record at *seq/*off (header only, unless 'body'), first
+// moving on to the next sector if this one has no more.  Returns false
+// if there's no record there, or it fails its check.
+bool Thermal_Spool::readRecord(uint32_t *seq, uint16_t *off, bool body) {
+  for(int tries=0; ; tries++) {
+    if(tries == 2) return false;
+    if((uint32_t)*off + RECORD_HEAD <= sectorBytes) {
+      if(!store->read((*seq % sectors) * sectorBytes + *off, record,
+        RECORD_HEAD)) return false;
+      if(record[0] != RECORD_ERASED) break;
+    }
+    (*seq)++;
+    *off = SPOOL_HEAD;
+  }
+  uint16_t len = record[2] | (record[3] << 8);
+  if((len < 4) || (len > THERMAL_SPOOL_RECORD + 4) ||
+    ((uint32_t)*off + RECORD_HEAD + len > sectorBytes)) return false;
+  if(!body) return true;
+  return store->read((*seq % sectors) * sectorBytes + *off + RECORD_HEAD,
+    record + RECORD_HEAD, len) &&
+    (check(record, RECORD_HEAD + len) == get32(record + 8));
+}
+
+// ----------------------------------------------------------------------
+// Queueing jobs
+
+Thermal_Spool::Job *Thermal_Spool::find(uint32_t id) {
+  for(int i=0; i<THERMAL_SPOOL_JOBS; i++) {
+    if((jobs[i].state != JOB_FREE) && (jobs[i].id == id)) return &jobs[i];
+  }
+  return NULL;
+}
+
+Thermal_Spool::Job *Thermal_Spool::freeJob() {
+  for(int i=0; i<THERMAL_SPOOL_JOBS; i++) {
+    if(jobs[i].state == JOB_FREE) return &jobs[i];
+  }
+  return NULL;
+}
+
+void Thermal_Spool::addRecord(uint8_t type, uint8_t flags, uint32_t id,
+  const uint8_t *data, size_t len, uint32_t value) {
+  size_t at   = pending.size();
+  size_t size = (RECORD_HEAD + 4 + len + 3) & ~3;
+  pending.resize(at + size, 0);
+  uint8_t *r = &pending[at];
+  r[0] = type;
+  r[1] = flags;
+  r[2] = (4 + len);
+  r[3] = (4 + len) >> 8;
+  set32(r + 4, id);
+  set32(r + RECORD_HEAD, value);
+  if(len) memcpy(r + RECORD_HEAD + 4, data, len);
+  set32(r + 8, check(r, RECORD_HEAD + 4 + len));
+}
+
+// Log bytes free for new records, after what's waiting to be stored
+// and what jobs in the log still need for their checkpoints.  Every
+// sector is assumed to lose the most a record can leave unused at its
+// end.
+size_t Thermal_Spool::room() {
+  uint32_t oldest   = headSeq;
+  size_t   reserved = pending.size();
+  for(int i=0; i<THERMAL_SPOOL_JOBS; i++) {
+    Job *j = &jobs[i];
+    if(j->state == JOB_FREE) continue;
+    if((j->state != JOB_PENDING) && ((int32_t)(j->seq - oldest) < 0))
+      oldest = j->seq;
+    reserved += ((j->records - j->printed) / THERMAL_SPOOL_CHECKPOINT + 2) *
+      (RECORD_HEAD + 4);
+  }
+  uint32_t inUse = headSeq - oldest + 1;
+  size_t   room  = 0;
+  if(inUse < sectors)
+    room = (sectors - inUse) * (sectorBytes - SPOOL_HEAD - RECORD_MAX);
+  if(sectorBytes - headOff > RECORD_MAX)
+    room += sectorBytes - headOff - RECORD_MAX;
+  return (room > reserved) ? room - reserved : 0;
+}
+
+// Queues the job printed into job() since the last endJob(), and starts
+// recording the next.  Returns its id, or 0 if the log or the job table
+// is full; the job is then kept, so call endJob() again once poll() has
+// made room (or dropJob() to give up on it).  Only works in memory;
+// poll() stores it.
+uint32_t Thermal_Spool::endJob() {
+  Thermal_Template t;
+  size_t           len;
+  const uint8_t   *image = builder.finish(&len);
+  Job             *j     = freeJob();
+  uint32_t         id    = 0;
+
+  if(!t.open(image, len)) {        // Nothing recorded
+    builder.clear();
+    return 0;
+  }
+  if(sectors && j) {
+    size_t   start   = pending.size();
+    uint32_t pos     = 0;
+    uint32_t records = 0;
+    for(uint16_t i=0; i<t.segments(); i++) {
+      uint32_t end = t.segmentEnd(i);
+      do {
+        uint32_t n = end - pos;
+        if(n > THERMAL_SPOOL_RECORD) n = THERMAL_SPOOL_RECORD;
+        addRecord(RECORD_DATA, (pos + n < end) ? FLAG_MORE : 0, nextId,
+          t.bytes() + pos, n, t.segmentDelay(i));
+        pos += n;
+        records++;
+      } while(pos < end);
+    }
+    addRecord(RECORD_END, 0, nextId, NULL, 0, records);
+    if((records <= 0xFFFF) && (room() >=
+      (records / THERMAL_SPOOL_CHECKPOINT + 2) * (RECORD_HEAD + 4))) {
+      j->id      = id = nextId++;
+      j->records = records;
+      j->printed = 0;
+      j->state   = JOB_PENDING;
+      builder.clear();
+    } else {
+      pending.resize(start);
+    }
+  }
+  return id;
+}
+
+// Discards the job being recorded, e.g. one endJob() found no room for.
+void Thermal_Spool::dropJob() {
+  builder.clear();
+}
+
+// Starts the log's next sector, if no job still needs what's in it.
+bool Thermal_Spool::openSector(uint32_t seq) {
+  uint8_t head[SPOOL_HEAD];
+  for(int i=0; i<THERMAL_SPOOL_JOBS; i++) {
+    Job *j = &jobs[i];
+    if((j->state != JOB_FREE) && (j->state != JOB_PENDING) &&
+      ((int32_t)(seq - j->seq) >= (int32_t)sectors)) return false;
+  }
+  uint32_t base = (seq % sectors) * sectorBytes;
+  set32(head, SPOOL_MAGIC);
+  set32(head + 4, seq);
+  if(!store->erase(base) || !store->program(base, head, SPOOL_HEAD))
+    return false;
+  bytesWritten += SPOOL_HEAD;
+  headSeq       = seq;
+  headOff       = SPOOL_HEAD;
+  return true;
+}
+
+// Programs pending records 'from' to 'to' at the head of the log, and
+// notes where the jobs among them now start or that they're complete.
+bool Thermal_Spool::programRun(size_t from, size_t to) {
+  if(to == from) return true;
+  if(!store->program((headSeq % sectors) * sectorBytes + headOff,
+    &pending[from], to - from)) return false;
+  bytesWritten += to - from;
+  while(from < to) {
+    const uint8_t *r    = &pending[from];
+    size_t         size = (RECORD_HEAD + (r[2] | (r[3] << 8)) + 3) & ~3;
+    Job           *j    = find(get32(r + 4));
+    if(j && (r[0] == RECORD_DATA) && (j->state == JOB_PENDING)) {
+      j->seq   = headSeq;
+      j->off   = headOff;
+      j->state = JOB_WRITING;
+    } else if(j && (r[0] == RECORD_END)) {
+      j->state = JOB_WRITTEN;
+    }
+    headOff += size;
+    from    += size;
+  }
+  return true;
+}
+
+// Appends everything pending to the log, a sector's worth per program
+// call, then syncs once.  Jobs become printable only after that.  What
+// a failure leaves unwritten stays pending for the next try.
+bool Thermal_Spool::commit() {
+  size_t pos = 0, run = 0;
+  bool   ok  = true;
+
+  while(pos < pending.size()) {
+    const uint8_t *r    = &pending[pos];
+    size_t         size = (RECORD_HEAD + (r[2] | (r[3] << 8)) + 3) & ~3;
+    if(headOff + (pos - run) + size > sectorBytes) {
+      if(!(ok = programRun(run, pos))) break;
+      run = pos;
+      if(!(ok = openSector(headSeq + 1))) break;
+    }
+    pos += size;
+  }
+  if(ok && (ok = programRun(run, pos))) run = pos;
+  pending.erase(pending.begin(), pending.begin() + run);
+  if(!store->sync()) return false;
+  syncs++;
+  for(int i=0; i<THERMAL_SPOOL_JOBS; i++) {
+    if(jobs[i].state == JOB_WRITTEN) jobs[i].state = JOB_QUEUED;
+  }
+  return ok;
+}
+
+// ----------------------------------------------------------------------
+// Printing
+
+// Stores whatever's been queued, then prints the next frame of the
+// oldest job if the printer can take it.  Progress is checkpointed only
+// once the printer has had time to print what was sent, and only at
+// the end of a frame.  Returns how
+// many microseconds until there's more to do (0 if now, or when idle).
+uint32_t Thermal_Spool::poll() {
+  if(pending.size()) commit();
+  if(current < 0) {
+    for(int i=0; i<THERMAL_SPOOL_JOBS; i++) {
+      Job *j = &jobs[i];
+      if((j->state == JOB_QUEUED) &&
+        ((current < 0) || ((int32_t)(j->id - jobs[current].id) < 0)))
+        current = i;
+    }
+    if(current < 0) return 0;
+    curSeq         = jobs[current].seq;
+    curOff         = jobs[current].off;
+    curIndex       = 0;
+    lastCheckpoint = jobs[current].printed;
+    midFrame       = false;
+  }
+
+  uint32_t wait = printer->readyIn();
+  if(wait) return wait;
+  Job *j = &jobs[current];
+  // A checkpoint inside a frame would resume with half a command, and
+  // one taken while output is still queued (setAsync()) would skip that
+  // output after a reset; so a due checkpoint first lets the queue empty.
+  if(!midFrame && (curIndex - lastCheckpoint >= THERMAL_SPOOL_CHECKPOINT)) {
+    if(printer->pending()) return printer->getByteTime();
+    addRecord(RECORD_PROGRESS, 0, j->id, NULL, 0, curIndex);
+    lastCheckpoint = curIndex;
+  }
+
+  for(;;) {
+    bool skip = curIndex < j->printed; // Printed before a reset
+    if(!readRecord(&curSeq, &curOff, !skip) || (get32(record + 4) != j->id)) {
+      addRecord(RECORD_DONE, 0, j->id, NULL, 0, 0); // Unreadable; give up
+      j->state = JOB_FREE;
+      current  = -1;
+      return 0;
+    }
+    uint16_t len = record[2] | (record[3] << 8);
+    curOff += (RECORD_HEAD + len + 3) & ~3;
+    if(record[0] == RECORD_END) {
+      addRecord(RECORD_DONE, 0, j->id, NULL, 0, 0);
+      j->state = JOB_FREE;
+      current  = -1;
+      return 0;
+    }
+    if(record[0] != RECORD_DATA) continue;
+    curIndex++;
+    if(skip) continue;
+    midFrame = record[1] & FLAG_MORE;
+    printer->writeEncoded(record + RECORD_HEAD + 4, len - 4,
+      midFrame ? 0 : get32(record + RECORD_HEAD));
+    return printer->readyIn();
+  }
+}
+
+// True when nothing's waiting to be stored or printed.
+bool Thermal_Spool::idle() {
+  return !pending.size() && !queued();
+}
+
+uint8_t Thermal_Spool::queued() {
+  uint8_t n = 0;
+  for(int i=0; i<THERMAL_SPOOL_JOBS; i++) {
+    if(jobs[i].state != JOB_FREE) n++;
+  }
+  return n;
+}
@@ -0,0 +1,156 @@
+/*------------------------------------------------------------------------
+  Crash-safe print spooler for the Thermal_Print library.
+
+  Jobs are recorded (as with Thermal_TemplateBuilder) into an append-
+  only log kept in flash on the Pico (Thermal_SpoolFlash) or in a file
+  on Linux (Thermal_SpoolFile), and printed from there.  Progress is
+  checkpointed every few frames, so after a reset begin() finds the
+  jobs that were queued or half printed and carries on: from the last
+  checkpoint (THERMAL_SPOOL_RESUME), or from the top of the job
+  (THERMAL_SPOOL_REPRINT).  A job is only printed once its last record
+  is safely stored; one cut short by a reset is dropped.
+
+    Thermal_SpoolFile store("/var/spool/receipts");
+    Thermal_Spool     spool(&store, &printer);
+    spool.begin();
+    spool.job().println("Table 4");  // Record a job...
+    spool.endJob();                  // ...and queue it
+    for(;;) spool.poll();            // From the main loop
+
+  endJob() never touches storage, so queueing stays quick however busy
+  the printer is; poll() writes queued jobs to the log in one go (one
+  sync for however many came in), then prints the next frame whenever
+  the printer can take it.  Storage written per job is its own bytes
+  plus a 12-byte header per record of up to THERMAL_SPOOL_RECORD bytes,
+  a 16-byte checkpoint every THERMAL_SPOOL_CHECKPOINT records (at the
+  next frame boundary, once a setAsync() printer's queue has emptied)
+  and one at the end; each sector of the log is erased once per trip
+  around it.  If endJob() finds the log full it keeps the job, to be
+  queued by a later endJob().
+
+  Frames after the last checkpoint may print twice after a reset, and a
+  resumed job carries on with the printer's default settings, so jobs
+  that must resume cleanly should set their styles on each line.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Spool_H
+#define Thermal_Spool_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "Thermal_Print.h"
+#include "Thermal_Template.h"
+
+#ifndef THERMAL_SPOOL_JOBS
+#define THERMAL_SPOOL_JOBS       32  // Jobs queued or printing at once
+#endif
+#ifndef THERMAL_SPOOL_RECORD
+#define THERMAL_SPOOL_RECORD     500 // Most bytes of output per record
+#endif
+#ifndef THERMAL_SPOOL_CHECKPOINT
+#define THERMAL_SPOOL_CHECKPOINT 8   // Fewest records between checkpoints
+#endif
+
+// What begin() does with a job that was cut short by a reset.
+#define THERMAL_SPOOL_RESUME  0 // Carry on from its last checkpoint
+#define THERMAL_SPOOL_REPRINT 1 // Print it again from the start
+
+// Storage the log lives in: a whole number of equal sectors, which read
+// as 0xFF once erased.  Programming only ever writes to erased bytes.
+class Thermal_SpoolStore {
+
+ public:
+
+  virtual ~Thermal_SpoolStore() {}
+
+  virtual uint32_t
+    size() = 0,                     // Bytes in all
+    sectorSize() = 0;               // Unit of erasing
+  virtual bool
+    read(uint32_t offset, uint8_t *buf, size_t len) = 0,
+    program(uint32_t offset, const uint8_t *buf, size_t len) = 0,
+    erase(uint32_t offset) = 0,     // The sector starting there
+    sync() { return true; }         // Make what's written so far stick
+};
+
+class Thermal_Spool {
+
+ public:
+
+  Thermal_Spool(Thermal_SpoolStore *store, Thermal_Print *printer);
+
+  bool
+    begin(uint8_t policy=THERMAL_SPOOL_RESUME), // Recover the log
+    idle();                         // Everything queued has printed
+  Thermal_Print
+    &job() { return builder.printer(); } // Print the next job into this
+  uint32_t
+    endJob(),                       // Queue it; id, or 0 if no room
+    poll();                         // Store and print; us until next
+  void
+    dropJob();                      // Discard it instead
+  uint8_t
+    queued();                       // Jobs not finished printing
+  unsigned long
+    bytesWritten,                   // Log bytes programmed so far
+    syncs;                          // Times the store was synced
+
+ private:
+
+  struct Job {
+    uint32_t id;
+    uint32_t seq;      // Sector and offset of its first record
+    uint16_t off;
+    uint16_t records;  // Data records in the job
+    uint16_t printed;  // Of those, printed (as of the last checkpoint)
+    uint8_t  state;
+  };
+
+  Thermal_SpoolStore
+    *store;
+  Thermal_Print
+    *printer;
+  Thermal_TemplateBuilder
+    builder;
+  std::vector<uint8_t>
+    pending;       // Records not yet in the log
+  Job
+    jobs[THERMAL_SPOOL_JOBS];
+  uint8_t
+    record[12 + THERMAL_SPOOL_RECORD + 4]; // The one being printed
+  uint32_t
+    sectorBytes,
+    sectors,
+    headSeq,       // Sector being appended to (in order written)
+    nextId,
+    curSeq;        // Next record of the job being printed
+  uint16_t
+    headOff,       // Where in it the next record goes
+    curOff,
+    curIndex,      // Data records of it passed so far
+    lastCheckpoint;
+  int
+    current;       // Job being printed, or -1
+  bool
+    midFrame;      // Last record printed continues in the next
+
+  bool
+    openSector(uint32_t seq),
+    programRun(size_t from, size_t to),
+    commit(),
+    readRecord(uint32_t *seq, uint16_t *off, bool body),
+    scan(uint32_t seq, uint16_t *end);
+  void
+    addRecord(uint8_t type, uint8_t flags, uint32_t id,
+      const uint8_t *data, size_t len, uint32_t value);
+  size_t
+    room();
+  Job
+    *find(uint32_t id),
+    *freeJob();
+};
+
+#endif // Thermal_Spool_H
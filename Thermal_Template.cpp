@@ -0,0 +1,236 @@
+/*------------------------------------------------------------------------
+  Pre-encoded print templates for the Thermal_Print library; see
+  Thermal_Template.h.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Thermal_Template.h"
+
+// Little-endian fields of the encoded image
+static uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static void put32(std::vector<uint8_t> &v, uint32_t x) {
+  for(int i=0; i<4; i++) v.push_back(x >> (i * 8));
+}
+
+static void put16(std::vector<uint8_t> &v, uint16_t x) {
+  v.push_back(x);
+  v.push_back(x >> 8);
+}
+
+Thermal_Template::Thermal_Template() {
+  image     = data = NULL;
+  owned     = NULL;
+  imageLen  = 0;
+  segCount  = slotCount = 0;
+}
+
+Thermal_Template::~Thermal_Template() {
+  free(owned);
+}
+
+// Uses an encoded image in place (it isn't copied, so it must outlive
+// the template).  Returns false, leaving the template empty, if it isn't
+// a well-formed image: segments and slots must be in order and inside
+// the data.
+bool Thermal_Template::open(const uint8_t *image, size_t len) {
+  segCount = slotCount = 0;
+  if((len < THERMAL_TEMPLATE_HEADER) || memcmp(image, "TPL1", 4))
+    return false;
+  uint16_t segs  = get16(image + 4), slots = get16(image + 6);
+  uint32_t bytes = get32(image + 8);
+  size_t   head  = THERMAL_TEMPLATE_HEADER +
+    (size_t)(segs + slots) * THERMAL_TEMPLATE_ENTRY;
+  if(len != head + bytes) return false;
+
+  const uint8_t *p = image + THERMAL_TEMPLATE_HEADER;
+  uint32_t       last = 0;
+  for(uint16_t i=0; i<segs; i++, p += THERMAL_TEMPLATE_ENTRY) {
+    uint32_t end = get32(p);
+    if((end < last) || (end > bytes)) return false;
+    last = end;
+  }
+  if(last != bytes) return false;
+  last = 0;
+  for(uint16_t i=0; i<slots; i++, p += THERMAL_TEMPLATE_ENTRY) {
+    uint32_t at = get32(p);
+    if((at < last) || (at + p[4] > bytes) || !p[4]) return false;
+    last = at + p[4];
+  }
+
+  this->image = image;
+  data        = image + head;
+  imageLen    = len;
+  segCount    = segs;
+  slotCount   = slots;
+  return true;
+}
+
+const uint8_t *Thermal_Template::entry(uint16_t i) const {
+  return image + THERMAL_TEMPLATE_HEADER + (size_t)i * THERMAL_TEMPLATE_ENTRY;
+}
+
+uint32_t Thermal_Template::segmentEnd(uint16_t i) const {
+  return get32(entry(i));
+}
+
+uint32_t Thermal_Template::segmentDelay(uint16_t i) const {
+  return get32(entry(i) + 4);
+}
+
+uint32_t Thermal_Template::slotOffset(uint16_t i) const {
+  return get32(entry(segCount + i));
+}
+
+uint8_t Thermal_Template::slotWidth(uint16_t i) const {
+  return entry(segCount + i)[4];
+}
+
+uint8_t Thermal_Template::slotAlign(uint16_t i) const {
+  return entry(segCount + i)[5];
+}
+
+// Printing time of the template, in microseconds, not counting time to
+// send the bytes themselves.
+unsigned long Thermal_Template::duration() const {
+  unsigned long total = 0;
+  for(uint16_t i=0; i<segCount; i++) total += segmentDelay(i);
+  return total;
+}
+
+#ifndef THERMAL_PICO
+bool Thermal_Template::load(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if(!f) return false;
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *buf = (len > 0) ? (uint8_t *)malloc(len) : NULL;
+  bool     ok  = buf && (fread(buf, 1, len, f) == (size_t)len) &&
+                 open(buf, len);
+  fclose(f);
+  if(!ok) {
+    free(buf);
+    return false;
+  }
+  free(owned);
+  owned = buf;
+  return true;
+}
+
+bool Thermal_Template::save(const char *path) const {
+  FILE *f = fopen(path, "wb");
+  if(!f) return false;
+  bool ok = (fwrite(image, 1, imageLen, f) == imageLen);
+  return !fclose(f) && ok;
+}
+
+// Writes the image as a C array named 'name', for building into Pico
+// firmware, where a const array stays in flash:
+//   #include "receipt.h"
+//   tpl.open(name, sizeof(name));
+bool Thermal_Template::saveSource(const char *path, const char *name) const {
+  FILE *f = fopen(path, "w");
+  if(!f) return false;
+  fprintf(f, "// Thermal_Print template: %u segments, %u slots\n",
+    segCount, slotCount);
+  fprintf(f, "static const uint8_t %s[%u] = {", name, (unsigned)imageLen);
+  for(size_t i=0; i<imageLen; i++)
+    fprintf(f, "%s0x%02x,", (i % 12) ? " " : "\n  ", image[i]);
+  fprintf(f, "\n};\n");
+  return !fclose(f);
+}
+#endif
+
+Thermal_TemplateBuilder::Thermal_TemplateBuilder() :
+  print(&recorder, &timer) {
+  recorder.owner = this;
+  timer.owner    = this;
+  timer.now      = 0;
+}
+
+void Thermal_TemplateBuilder::Recorder::write(const uint8_t *buf,
+  size_t len) {
+  owner->data.insert(owner->data.end(), buf, buf + len);
+}
+
+void Thermal_TemplateBuilder::Timer::sleepMicros(uint32_t us) {
+  now += us;
+  owner->delay(us);
+}
+
+// A wait ends the frame so far; waits with nothing sent in between add
+// up.  A wait before anything has been sent has nothing to pace.
+void Thermal_TemplateBuilder::delay(uint32_t us) {
+  if(segs.size() && (segs.back().end == data.size())) {
+    segs.back().delay += us;
+  } else if(data.size()) {
+    Segment s = { (uint32_t)data.size(), us };
+    segs.push_back(s);
+  }
+}
+
+// Sends 'width' spaces as a placeholder for a value filled in at print
+// time, aligned 'L', 'C' or 'R' within them.  Returns the slot's index
+// in printTemplate()'s values, or -1 for a zero width.
+int Thermal_TemplateBuilder::slot(uint8_t width, char align) {
+  if(!width) return -1;
+  Slot s = { (uint32_t)(data.size() + print.outLen + print.batchLen),
+             width, (uint8_t)align };
+  uint8_t spaces[255];
+  memset(spaces, ' ', width);
+  print.write(spaces, width);
+  slotList.push_back(s);
+  return slotList.size() - 1;
+}
+
+// Ends the recording (waiting out the last delay, so it's included) and
+// encodes it.  The image stays valid until the builder is cleared or
+// destroyed.
+const uint8_t *Thermal_TemplateBuilder::finish(size_t *len) {
+  print.drain();
+  if(data.size() && (!segs.size() || (segs.back().end != data.size()))) {
+    Segment s = { (uint32_t)data.size(), 0 };
+    segs.push_back(s);
+  }
+
+  image.clear();
+  static const uint8_t magic[] = { 'T', 'P', 'L', '1' };
+  image.insert(image.end(), magic, magic + 4);
+  put16(image, segs.size());
+  put16(image, slotList.size());
+  put32(image, data.size());
+  for(size_t i=0; i<segs.size(); i++) {
+    put32(image, segs[i].end);
+    put32(image, segs[i].delay);
+  }
+  for(size_t i=0; i<slotList.size(); i++) {
+    put32(image, slotList[i].offset);
+    image.push_back(slotList[i].width);
+    image.push_back(slotList[i].align);
+    put16(image, 0);
+  }
+  image.insert(image.end(), data.begin(), data.end());
+  *len = image.size();
+  return image.data();
+}
+
+// Forgets the recording.  The printer's settings are forgotten too, so
+// the next template starts by sending every setting it uses.
+void Thermal_TemplateBuilder::clear() {
+  data.clear();
+  image.clear();
+  segs.clear();
+  slotList.clear();
+  print.invalidateState();
+}
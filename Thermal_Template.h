@@ -0,0 +1,153 @@
+/*------------------------------------------------------------------------
+  Pre-encoded print templates for the Thermal_Print library.
+
+  A receipt that's always laid out the same way, with only totals, dates
+  and order numbers changing, can be encoded once instead of being
+  rebuilt command by command on every print.  Thermal_TemplateBuilder
+  records what its own Thermal_Print sends: the command bytes, the
+  pacing delay after each frame, and the place of each slot (a
+  fixed-width field filled in at print time).  The result is a single
+  immutable byte image.  Thermal_Print::printTemplate() then just
+  streams the image, patching the slots on the way out, with no
+  per-command work at all.
+
+  Images can be built at start-up, or built on a host and saved, either
+  as a file for load() or as C source that compiles into flash on the
+  Pico.  Timings are those of the builder's printer, so give it the same
+  profile and setTimes() as the printer that will play the template.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Template_H
+#define Thermal_Template_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "Thermal_Print.h"
+
+// Encoded image layout, all numbers little-endian:
+//   "TPL1"                               magic
+//   u16 segments, u16 slots, u32 bytes   counts
+//   segments x { u32 end, u32 delay }    frame ends at data offset 'end',
+//                                        then 'delay' us before the next
+//   slots x { u32 offset, u8 width, u8 align, u16 0 }  in offset order
+//   bytes of command data
+#define THERMAL_TEMPLATE_HEADER 12
+#define THERMAL_TEMPLATE_ENTRY   8
+
+// Fixed-size read-only view of an encoded image (which may be in flash).
+class Thermal_Template {
+
+ public:
+
+  Thermal_Template();
+  ~Thermal_Template();
+  // Owns the image load() read, so copies would free it twice.
+  Thermal_Template(const Thermal_Template &) = delete;
+  Thermal_Template &operator=(const Thermal_Template &) = delete;
+
+  bool
+    open(const uint8_t *image, size_t len); // Check and use 'image'
+  uint16_t segments() const { return segCount; }
+  uint16_t slots() const    { return slotCount; }
+  uint32_t
+    segmentEnd(uint16_t i) const,
+    segmentDelay(uint16_t i) const,
+    slotOffset(uint16_t i) const;
+  uint8_t
+    slotWidth(uint16_t i) const,
+    slotAlign(uint16_t i) const;
+  const uint8_t *bytes() const { return data; } // Command data
+  size_t size() const { return imageLen; }       // Whole image
+  unsigned long
+    duration() const;                       // Sum of segment delays, us
+#ifndef THERMAL_PICO
+  bool
+    load(const char *path),                 // Read an image file
+    save(const char *path) const,           // Write one
+    saveSource(const char *path, const char *name) const; // As C array
+#endif
+
+ private:
+
+  const uint8_t
+    *image,        // Whole encoded image
+    *data;         // Command bytes within it
+  uint8_t
+    *owned;        // Image memory from load(), freed with the template
+  size_t
+    imageLen;
+  uint16_t
+    segCount,
+    slotCount;
+  const uint8_t
+    *entry(uint16_t i) const; // Segment i, then slot i - segCount
+};
+
+// Records a template.  Print the layout through printer(), calling
+// slot() wherever a value goes, then finish() for the encoded image.
+class Thermal_TemplateBuilder {
+
+ public:
+
+  Thermal_TemplateBuilder();
+
+  Thermal_Print
+    &printer() { return print; }
+  int
+    slot(uint8_t width, char align='L'); // Placeholder; returns its index
+  const uint8_t
+    *finish(size_t *len);                // Encoded image (builder owns it)
+  void
+    clear();                             // Start a new template
+
+ private:
+
+  // Keeps everything the printer sends...
+  class Recorder : public Thermal_Transport {
+   public:
+    Thermal_TemplateBuilder *owner;
+    bool   begin(uint32_t) { return true; }
+    void   setBaudRate(uint32_t) {}
+    void   write(const uint8_t *buf, size_t len);
+    size_t writable() { return (size_t)-1; }
+    int    read() { return -1; }
+  };
+  // ...and turns its waits into segment delays, without really waiting.
+  class Timer : public Thermal_Clock {
+   public:
+    Thermal_TemplateBuilder *owner;
+    uint32_t now;
+    uint32_t micros() { return now; }
+    void     sleepMicros(uint32_t us);
+  };
+
+  struct Segment {
+    uint32_t end, delay;
+  };
+  struct Slot {
+    uint32_t offset;
+    uint8_t  width, align;
+  };
+
+  Recorder
+    recorder;
+  Timer
+    timer;
+  Thermal_Print
+    print;
+  std::vector<uint8_t>
+    data,          // Command bytes recorded so far
+    image;         // Result of finish()
+  std::vector<Segment>
+    segs;
+  std::vector<Slot>
+    slotList;
+
+  void
+    delay(uint32_t us);
+};
+
+#endif // Thermal_Template_H
@@ -0,0 +1,15 @@
+/*------------------------------------------------------------------------
+  Transport and clock interfaces for the Thermal_Print library.
+  See Thermal_Transport.h for an overview.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#include "Thermal_Transport.h"
+
+// Transports without a native gathered write send the pieces in turn.
+void Thermal_Transport::writev(const Thermal_IOVec *iov, int count) {
+  for(int i=0; i<count; i++) {
+    if(iov[i].len) write(iov[i].data, iov[i].len);
+  }
+}
@@ -0,0 +1,85 @@
+/*------------------------------------------------------------------------
+  Transport and clock interfaces for the Thermal_Print library.
+
+  Thermal_Print does all of its I/O and timekeeping through these two
+  classes, so the same printer code runs on a Raspberry Pi Pico UART
+  (Thermal_Pico.h) or a Linux serial port (Thermal_Linux.h), or against
+  anything else that implements them.
+
+  MIT license, all text above must be included in any redistribution.
+  ------------------------------------------------------------------------*/
+
+#ifndef Thermal_Transport_H
+#define Thermal_Transport_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+class Thermal_Print;
+
+// One piece of a gathered write (see Thermal_Transport::writev()).
+struct Thermal_IOVec {
+  const uint8_t *data;
+  size_t         len;
+};
+
+// Byte stream to the printer.
+class Thermal_Transport {
+
+ public:
+
+  virtual ~Thermal_Transport() {}
+
+  virtual bool
+    begin(uint32_t baud) = 0;       // Open/configure the port
+  virtual void
+    setBaudRate(uint32_t baud) = 0,
+    write(const uint8_t *buf, size_t len) = 0, // Blocks until accepted
+    writev(const Thermal_IOVec *iov, int count);
+  virtual size_t
+    writable() = 0;                 // Bytes write() takes without blocking
+  virtual int
+    read() = 0;                     // Next received byte, or -1 if none
+
+  // Optional: printer-driven flow control (THERMAL_FLOW_* modes; see
+  // Thermal_Print::setFlowControl()), waiting for output to drain, and
+  // ruling out rates the port can't do.
+  virtual bool setFlowControl(uint8_t, uint8_t) { return false; }
+  virtual bool busy() { return false; } // Printer's busy line asserted
+  virtual void flush() {}               // Wait until output is on the wire
+  virtual bool supportsBaud(uint32_t) { return true; } // Rate is usable
+};
+
+// Time source.  micros() is expected to wrap at 32 bits.
+class Thermal_Clock {
+
+ public:
+
+  virtual ~Thermal_Clock() {}
+
+  virtual uint32_t
+    micros() = 0;
+  virtual void
+    sleepMicros(uint32_t us) = 0;
+  // Arranges for p->service() to be called after 'us' microseconds, and
+  // again after however long each call returns, until it returns 0.
+  // Returns false if background timers aren't available; the owner of
+  // the printer must then call service() itself.
+  virtual bool
+    startTimer(Thermal_Print *, uint32_t) { return false; }
+};
+
+// Discards output and never receives anything.
+class Thermal_NullTransport : public Thermal_Transport {
+
+ public:
+
+  bool   begin(uint32_t) { return true; }
+  void   setBaudRate(uint32_t) {}
+  void   write(const uint8_t *, size_t) {}
+  size_t writable() { return (size_t)-1; }
+  int    read() { return -1; }
+};
+
+#endif // Thermal_Transport_H